@@ -9,6 +9,8 @@
  */
 #define __FLX_H__
 
+#include <stddef.h>
+
 /**
  * @struct Score result.
  */
@@ -18,6 +20,134 @@ typedef struct {
     int  tail;
 } flx_result;
 
+/**
+ * @struct Score result written into caller-owned memory, see `flx_score_into`.
+ */
+typedef struct {
+    int  score;    /* The score (string distance) */
+    int* indices;  /* Caller buffer for the indicies occurrence; may be NULL */
+    int  capacity; /* Number of ints INDICES can hold */
+    int  len;      /* Number of indicies in the match */
+    int  tail;
+} flx_result_buf;
+
+/**
+ * @struct Batch match entry.
+ */
+typedef struct {
+    size_t index;  /* Index of the candidate */
+    int    score;  /* The score (string distance) */
+} flx_match;
+
+/**
+ * @struct Bump allocator for scratch memory, see `flx_arena_new`.
+ */
+typedef struct flx_arena flx_arena;
+
+/**
+ * Create an arena for scratch memory.
+ *
+ * Keep one arena per thread and pass it to the `_arena` functions, so the
+ * scratch memory of every call is recycled instead of going through malloc.
+ * @param size Bytes per block; 0 uses the default.
+ * @return The arena; free it with `flx_arena_free`.
+ */
+flx_arena* flx_arena_new(size_t size);
+
+/**
+ * Release everything allocated from ARENA and keep its memory for reuse.
+ * @param *arena The arena to reset.
+ */
+void flx_arena_reset(flx_arena* arena);
+
+/**
+ * Free arena.
+ * @param *arena The arena to free.
+ */
+void flx_arena_free(flx_arena* arena);
+
+/**
+ * @struct Compiled query, see `flx_query_compile`.
+ */
+typedef struct flx_query flx_query;
+
+/**
+ * Compile QUERY for repeated scoring.
+ * @param *query Query use to score.
+ * @return The compiled query; free it with `flx_query_free`.
+ */
+flx_query* flx_query_compile(const char* query);
+
+/**
+ * Same as `flx_query_compile` with the LEN chars of QUERY.
+ */
+flx_query* flx_query_compile_n(const char* query, size_t len);
+
+/**
+ * Compile QUERY for scoring '/'-separated paths.
+ *
+ * Path segments are scored as separate groups, and the basename gets the
+ * basepath boost, so matches in file names rank above matches spread over
+ * directories.  Batch functions reuse the heatmap of a directory for the
+ * sibling paths that follow it, which is cheapest when paths come sorted as
+ * from `git ls-files`.
+ * @param *query Query use to score.
+ * @return The compiled query; free it with `flx_query_free`.
+ */
+flx_query* flx_query_compile_path(const char* query);
+
+/**
+ * Same as `flx_query_compile_path` with the LEN chars of QUERY.
+ */
+flx_query* flx_query_compile_path_n(const char* query, size_t len);
+
+/**
+ * Free compiled query.
+ * @param *query The compiled query to free.
+ */
+void flx_query_free(flx_query* query);
+
+/**
+ * @struct Prepared candidate, see `flx_candidate_new`.
+ */
+typedef struct flx_candidate flx_candidate;
+
+/**
+ * Prepare STR for repeated scoring.
+ *
+ * The heatmap and char positions are computed once and reused for every
+ * query scored against the candidate.
+ * @param *str String to prepare.
+ * @return The prepared candidate; free it with `flx_candidate_free`.
+ */
+flx_candidate* flx_candidate_new(const char* str);
+
+/**
+ * Same as `flx_candidate_new` with the LEN chars of STR.
+ */
+flx_candidate* flx_candidate_new_n(const char* str, size_t len);
+
+/**
+ * Same as `flx_candidate_new` for a '/'-separated path, see
+ * `flx_query_compile_path`.
+ *
+ * The heatmap is built for one mode: a path candidate only matches queries
+ * from `flx_query_compile_path`, and a candidate from `flx_candidate_new`
+ * only the others.  Any other pairing never matches.
+ */
+flx_candidate* flx_candidate_new_path(const char* str);
+
+/**
+ * Same as `flx_candidate_new_path` with the LEN chars of STR.
+ */
+flx_candidate* flx_candidate_new_path_n(const char* str, size_t len);
+
+/**
+ * Free prepared candidate.
+ * @param *candidate The prepared candidate to free.
+ */
+void flx_candidate_free(flx_candidate* candidate);
+
 /**
  * Free result.
  * @param *result The score result to free.
@@ -31,4 +161,355 @@ void flx_free(flx_result* result);
  */
 flx_result* flx_score(const char* str, const char* query);
 
+/**
+ * Same as `flx_score` with the LEN chars of STR and the QLEN chars of QUERY.
+ *
+ * Neither string needs to be NUL-terminated, so slices of a larger buffer
+ * are scored in place; every `_n` function works the same way.
+ * @param *str String to test.
+ * @param len Length of STR.
+ * @param *query Query use to score.
+ * @param qlen Length of QUERY.
+ */
+flx_result* flx_score_n(const char* str, size_t len, const char* query, size_t qlen);
+
+/**
+ * Score QUERY against STR into the caller-provided OUT.
+ *
+ * Nothing is allocated for the result, and the scratch memory of typical
+ * inputs lives on the stack.  At most OUT->capacity indices are written;
+ * OUT->len always holds the full count.
+ *
+ * With no index buffer only the score is computed, which skips the position
+ * tracking entirely.  Rank with that, then score the few results you display
+ * again with a buffer to get their indices.
+ * @param *str String to test.
+ * @param *query Query use to score.
+ * @param *out Receive the score and up to OUT->capacity indices.
+ * @return Non-zero if there is a match.
+ */
+int flx_score_into(const char* str, const char* query, flx_result_buf* out);
+
+/**
+ * Same as `flx_score_into` with the LEN chars of STR and the QLEN chars of
+ * QUERY.
+ */
+int flx_score_into_n(const char* str, size_t len, const char* query, size_t qlen,
+                     flx_result_buf* out);
+
+/**
+ * Return best score matching compiled QUERY against STR.
+ * @param *str String to test.
+ * @param *query Compiled query use to score.
+ */
+flx_result* flx_score_q(const char* str, const flx_query* query);
+
+/**
+ * Same as `flx_score_q` with the LEN chars of STR.
+ */
+flx_result* flx_score_q_n(const char* str, size_t len, const flx_query* query);
+
+/**
+ * Same as `flx_score_q` with scratch memory from ARENA.
+ * @param *str String to test.
+ * @param *query Compiled query use to score.
+ * @param *arena Scratch memory; reset by the call.
+ */
+flx_result* flx_score_arena(const char* str, const flx_query* query, flx_arena* arena);
+
+/**
+ * Same as `flx_score_arena` with the LEN chars of STR.
+ */
+flx_result* flx_score_arena_n(const char* str, size_t len, const flx_query* query,
+                              flx_arena* arena);
+
+/**
+ * Same as `flx_score_into` with a compiled QUERY.
+ * @param *str String to test.
+ * @param *query Compiled query use to score.
+ * @param *out Receive the score and up to OUT->capacity indices.
+ * @return Non-zero if there is a match.
+ */
+int flx_score_into_q(const char* str, const flx_query* query, flx_result_buf* out);
+
+/**
+ * Same as `flx_score_into_q` with the LEN chars of STR.
+ */
+int flx_score_into_q_n(const char* str, size_t len, const flx_query* query, flx_result_buf* out);
+
+/**
+ * Same as `flx_score_into_q` with scratch memory from ARENA.
+ *
+ * Long strings, tracked with an index buffer, can outgrow the stack; an
+ * arena kept across calls then allocates nothing once warm.
+ * @param *str String to test.
+ * @param *query Compiled query use to score.
+ * @param *arena Scratch memory; reset by the call.
+ * @param *out Receive the score and up to OUT->capacity indices.
+ * @return Non-zero if there is a match.
+ */
+int flx_score_into_arena(const char* str, const flx_query* query, flx_arena* arena,
+                         flx_result_buf* out);
+
+/**
+ * Same as `flx_score_into_arena` with the LEN chars of STR.
+ */
+int flx_score_into_arena_n(const char* str, size_t len, const flx_query* query, flx_arena* arena,
+                           flx_result_buf* out);
+
+/**
+ * Return best score matching compiled QUERY against prepared CANDIDATE.
+ * @param *candidate Prepared string to test.
+ * @param *query Compiled query use to score.
+ */
+flx_result* flx_score_candidate(const flx_candidate* candidate, const flx_query* query);
+
+/**
+ * Same as `flx_score_candidate` with scratch memory from ARENA.
+ * @param *candidate Prepared string to test.
+ * @param *query Compiled query use to score.
+ * @param *arena Scratch memory; reset by the call.
+ */
+flx_result* flx_score_candidate_arena(const flx_candidate* candidate, const flx_query* query,
+                                      flx_arena* arena);
+
+/**
+ * Compute a score that QUERY against STR cannot exceed, without the search.
+ *
+ * Each query char is credited with its best heatmap value and each pair of
+ * neighbours with the full contiguity bonus, plus the full-match boost when
+ * it applies.  Use it to skip strings that cannot beat a known score.
+ * @param *str String to test.
+ * @param *query Query use to score.
+ * @param *bound Receive the bound.
+ * @return Non-zero if a match is possible at all.
+ */
+int flx_score_upper_bound(const char* str, const char* query, int* bound);
+
+/**
+ * Same as `flx_score_upper_bound` with the LEN chars of STR and the QLEN
+ * chars of QUERY.
+ */
+int flx_score_upper_bound_n(const char* str, size_t len, const char* query, size_t qlen,
+                            int* bound);
+
+/**
+ * Same as `flx_score_upper_bound` with a prepared CANDIDATE and a compiled
+ * QUERY.
+ */
+int flx_score_upper_bound_candidate(const flx_candidate* candidate, const flx_query* query,
+                                    int* bound);
+
+/**
+ * Score every candidate against QUERY and sort the matches.
+ *
+ * Matches are ordered by score (descending), then by candidate index.
+ * @param **candidates Strings to test.
+ * @param n Number of candidates.
+ * @param *query Query use to score.
+ * @param *out Receive the matches; must hold N entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_score_many(const char** candidates, size_t n, const char* query, flx_match* out);
+
+/**
+ * Same as `flx_score_many` with a compiled QUERY.
+ */
+size_t flx_score_many_q(const char** candidates, size_t n, const flx_query* query,
+                        flx_match* out);
+
+/**
+ * Same as `flx_score_many` with prepared CANDIDATES and a compiled QUERY.
+ */
+size_t flx_score_candidates(const flx_candidate** candidates, size_t n, const flx_query* query,
+                            flx_match* out);
+
+/**
+ * Score every candidate against QUERY and keep only the best K matches.
+ *
+ * Matches are ordered as with `flx_score_many`, and OUT ends up holding the
+ * first K of them.  Once K matches are in, a candidate that cannot beat the
+ * worst of them is dropped without running the search.
+ * @param **candidates Strings to test.
+ * @param n Number of candidates.
+ * @param *query Query use to score.
+ * @param k Number of matches to keep.
+ * @param *out Receive the matches; must hold K entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_score_top(const char** candidates, size_t n, const char* query, size_t k,
+                     flx_match* out);
+
+/**
+ * Same as `flx_score_top` with a compiled QUERY.
+ */
+size_t flx_score_top_q(const char** candidates, size_t n, const flx_query* query, size_t k,
+                       flx_match* out);
+
+/**
+ * Same as `flx_score_top` with prepared CANDIDATES and a compiled QUERY.
+ */
+size_t flx_score_top_candidates(const flx_candidate** candidates, size_t n,
+                                const flx_query* query, size_t k, flx_match* out);
+
+/**
+ * Same as `flx_score_top_q`, spread over THREADS threads.
+ *
+ * The candidates are split into chunks; each thread scores its share with
+ * its own scratch memory and best K matches, and steals chunks from the
+ * others once it runs out.  The result is the same as `flx_score_top_q`.
+ *
+ * The threads are created and joined within each call, so the cost of
+ * starting them, tens of microseconds each, is paid every time; for short
+ * lists `flx_score_top_q` is faster.
+ * @param **candidates Strings to test.
+ * @param n Number of candidates.
+ * @param *query Compiled query use to score.
+ * @param k Number of matches to keep.
+ * @param threads Number of threads, the calling one included; 0 uses one
+ *                per processor.
+ * @param *out Receive the matches; must hold K entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_score_top_parallel(const char** candidates, size_t n, const flx_query* query, size_t k,
+                              int threads, flx_match* out);
+
+/**
+ * Same as `flx_score_top_parallel` with prepared CANDIDATES.
+ */
+size_t flx_score_top_candidates_parallel(const flx_candidate** candidates, size_t n,
+                                         const flx_query* query, size_t k, int threads,
+                                         flx_match* out);
+
+/**
+ * @struct Streaming ranker over newline-delimited input, see `flx_stream_new`.
+ */
+typedef struct flx_stream flx_stream;
+
+/**
+ * Create a stream that ranks the lines it reads against compiled QUERY.
+ *
+ * Feed it with `flx_stream_read` while the producer is still writing, and
+ * take `flx_stream_snapshot` whenever results should be shown.  Only the
+ * unfinished line and the best K lines are kept, so memory stays bounded
+ * however long the input.  Match indices are line numbers, from 0.
+ * @param *query Compiled query use to score; must outlive the stream.
+ * @param k Number of matches to keep.
+ * @return The stream; free it with `flx_stream_free`.
+ */
+flx_stream* flx_stream_new(const flx_query* query, size_t k);
+
+/**
+ * Read the next chunk of FD into STREAM and rank the lines it completes.
+ *
+ * Blocks as `read` does.  At end of input the last line is ranked even
+ * without a trailing newline.
+ * @param *stream The stream.
+ * @param fd File descriptor to read.
+ * @return Bytes read; 0 at end of input, -1 on error.
+ */
+long flx_stream_read(flx_stream* stream, int fd);
+
+/**
+ * Copy the current best matches of STREAM into OUT, sorted as with
+ * `flx_score_many`.
+ * @param *stream The stream.
+ * @param *out Receive the matches; must hold K entries.
+ * @param **strs Receive the text of each match unless NULL; valid until the
+ *               next read.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_stream_snapshot(const flx_stream* stream, flx_match* out, const char** strs);
+
+/**
+ * Free stream.
+ * @param *stream The stream to free.
+ */
+void flx_stream_free(flx_stream* stream);
+
+/**
+ * @struct Lines of a memory-mapped file, see `flx_corpus_open`.
+ */
+typedef struct flx_corpus flx_corpus;
+
+/**
+ * Map the file at PATH and index its lines.
+ *
+ * Lines are scored in place in the mapped pages, with no copy per line; only
+ * the start of each line is kept.  A trailing CR is not part of a line.
+ * @param *path File to open.
+ * @return The corpus, or NULL if the file cannot be mapped; free it with
+ *         `flx_corpus_free`.
+ */
+flx_corpus* flx_corpus_open(const char* path);
+
+/**
+ * Return the number of lines in CORPUS.
+ * @param *corpus The corpus.
+ */
+size_t flx_corpus_count(const flx_corpus* corpus);
+
+/**
+ * Return line INDEX of CORPUS, without its line terminator.
+ * @param *corpus The corpus.
+ * @param index Line number, from 0.
+ * @param *len Receive the length of the line.
+ * @return The line, in the mapped file; not NUL-terminated.
+ */
+const char* flx_corpus_line(const flx_corpus* corpus, size_t index, size_t* len);
+
+/**
+ * Same as `flx_score_top_q` over the lines of CORPUS; match indices are line
+ * numbers.
+ */
+size_t flx_corpus_top(const flx_corpus* corpus, const flx_query* query, size_t k,
+                      flx_match* out);
+
+/**
+ * Same as `flx_score_top_parallel` over the lines of CORPUS.
+ */
+size_t flx_corpus_top_parallel(const flx_corpus* corpus, const flx_query* query, size_t k,
+                               int threads, flx_match* out);
+
+/**
+ * Free corpus and unmap its file.
+ * @param *corpus The corpus to free.
+ */
+void flx_corpus_free(flx_corpus* corpus);
+
+/**
+ * @struct Paths indexed by their shared directories, see `flx_trie_new`.
+ */
+typedef struct flx_trie flx_trie;
+
+/**
+ * Index PATHS by their shared directories, in a trie whose nodes are
+ * directories and whose single-child chains are merged.
+ *
+ * A search matches the query against each directory name once for every
+ * path under it, and skips a whole directory when the query chars still
+ * unmatched do not all occur in it.
+ * @param **paths Paths to index; must outlive the trie.
+ * @param n Number of paths.
+ * @return The trie; free it with `flx_trie_free`.
+ */
+flx_trie* flx_trie_new(const char** paths, size_t n);
+
+/**
+ * Same as `flx_trie_new` with the lines of CORPUS; match indices are line
+ * numbers.
+ */
+flx_trie* flx_trie_new_corpus(const flx_corpus* corpus);
+
+/**
+ * Same as `flx_score_top_q` over the paths of TRIE.
+ */
+size_t flx_trie_top(const flx_trie* trie, const flx_query* query, size_t k, flx_match* out);
+
+/**
+ * Free trie.
+ * @param *trie The trie to free.
+ */
+void flx_trie_free(flx_trie* trie);
+
 #endif /* __FLX_H__ */
@@ -8,10 +8,36 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FLX_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #ifndef STB_DS_IMPLEMENTATION
 #define STB_DS_IMPLEMENTATION
@@ -31,580 +57,3572 @@ static const char word_separators[] = {
 static const int default_score = -35;
 
 /**
- * Create a new result.
+ * Create a new result from the match in BUF.
  */
-static flx_result new_result(int* indicies, int score, int tail) {
-    flx_result new_result;
-    new_result.indices = indicies;
-    new_result.score   = score;
-    new_result.tail    = tail;
+static flx_result* new_result(const flx_result_buf* buf) {
+    flx_result* new_result = malloc(1 * sizeof(*new_result));
+    new_result->indices    = NULL;
+    new_result->score      = buf->score;
+    new_result->tail       = buf->tail;
+
+    arrsetlen(new_result->indices, buf->len);
+    memcpy(new_result->indices, buf->indices, sizeof(int) * buf->len);
+
     return new_result;
 }
 
 /**
- * @struct Hashmap for value int.
+ * Alignment of every arena allocation.
  */
-typedef struct {
-    int  key;
-    int* value;
-} hm_int;
+#define ARENA_ALIGN sizeof(long long)
+
+/**
+ * Default size of an arena block.
+ */
+#define ARENA_BLOCK_SIZE 16384
+
+/**
+ * Bytes of stack that seed the arena of a one-shot call.
+ */
+#define STACK_ARENA_SIZE 16384
+
+/**
+ * Longest string, and query, the bit-parallel search takes; one bit per
+ * position.
+ */
+#define SHORT_MAX 64
+
+/**
+ * Candidates a worker of the parallel ranking claims at a time.
+ */
+#define POOL_CHUNK_SIZE 1024
+
+/**
+ * Bytes a stream reads at a time.
+ */
+#define STREAM_CHUNK_SIZE 65536
+
+/**
+ * @struct Memory block of an arena; the memory follows the header.
+ */
+typedef struct flx_block {
+    struct flx_block* next;  /* Older block */
+    size_t            size;  /* Usable bytes */
+    size_t            used;  /* Bytes handed out */
+    bool              owned; /* Allocated by the arena */
+} flx_block;
+
+/**
+ * @struct Bump allocator for scratch memory.
+ */
+struct flx_arena {
+    flx_block* head;       /* Block in use */
+    size_t     block_size; /* Minimum size of a new block */
+};
+
+/**
+ * @struct Compiled query.
+ */
+struct flx_query {
+    const char* str;              /* Query chars as typed */
+    int         len;              /* Query length */
+    bool        full_match_boost; /* Boost matches covering the whole string */
+    uint64_t    mask;             /* Char-presence mask of the query chars */
+    char        separator;        /* Group separator of the strings, or NIL */
+};
 
 /**
- * @struct Hashmap for value flx_result.
+ * @struct Heatmap of the directory of the last path scored, for its siblings.
  */
 typedef struct {
-    int         key;
-    flx_result* value;
-} hm_score;
+    char* dir;        /* Directory, separator included */
+    int   dir_len;    /* Length of DIR */
+    int   separators; /* Separators in DIR */
+    int*  heatmap;    /* Heatmap of DIR within its paths */
+    int   cap;        /* Capacity of DIR and HEATMAP */
+} path_cache;
 
 /**
- * Insert data to hm_int hash map.
+ * @struct Prepared candidate; everything that depends only on the string.
  */
-static void insert_dict(hm_int** dic, int key, int val) {
-    int* new_arr = hmget(*dic, key);
+struct flx_candidate {
+    int      len;       /* String length */
+    uint64_t mask;      /* Char-presence mask of the keys */
+    int*     heatmap;   /* Heatmap of the string */
+    uint64_t keys[4];   /* Bit set of the chars of the char index */
+    uint8_t  ranks[4];  /* Number of keys before each word of KEYS */
+    int      keys_len;  /* Number of keys */
+    int*     offsets;   /* Start of each key in POSITIONS, plus the end */
+    int*     positions; /* Sorted positions of each key */
+    char     separator; /* Group separator of the heatmap, or NIL */
+};
 
-    if (!new_arr) {
-        new_arr = NULL;
-    }
+/**
+ * @struct Lines of a memory-mapped file.
+ */
+struct flx_corpus {
+    const char* data;   /* Mapped file, or NULL when empty */
+    size_t      size;   /* Bytes in DATA */
+    size_t*     starts; /* Start of each line, plus one past the end of the last */
+    size_t      count;  /* Number of lines */
+};
 
-    arrins(new_arr, 0, val);
+/**
+ * @struct Path of a trie, borrowed from the caller.
+ */
+typedef struct {
+    const char* str;
+    int         len;
+    size_t      index; /* Index of the path as given */
+} trie_entry;
 
-    hmput(*dic, key, new_arr);
-}
+/**
+ * @struct Directory of a trie; its paths are ENTRIES[BEGIN] up to ENTRIES[END].
+ *
+ * All the paths of a node share their first LABEL_END chars, of which the
+ * node adds those from LABEL_START on; single-child chains are merged.
+ */
+typedef struct {
+    size_t   begin;
+    size_t   end;
+    int      label_start;
+    int      label_end;
+    uint64_t mask;         /* Char-presence mask of everything from LABEL_START */
+    int      first_child;  /* Subdirectory, or -1 */
+    int      next_sibling; /* Next subdirectory of the parent, or -1 */
+} trie_node;
+
+struct flx_trie {
+    trie_entry* entries; /* Paths in sorted order */
+    trie_node*  nodes;   /* Directories; the root is first */
+};
 
 /**
- * Clone the hm_int* hash map.
+ * @struct Text of a line kept by a stream, by line number.
  */
-static void clone_hm_int(const hm_int* src, hm_int** dest) {
-    if (!src) {
-        return;
-    }
+typedef struct {
+    size_t key;
+    char*  value;
+} stream_text;
+
+struct flx_stream {
+    const flx_query* query;
+    size_t           k;
+    flx_match*       heap;  /* Best K matches; the index is the line number */
+    size_t           count; /* Matches in HEAP */
+    stream_text*     texts; /* Text of the lines in HEAP */
+    size_t           lines; /* Lines scored so far */
+    char*            buf;   /* Unscored input */
+    size_t           len;   /* Bytes in BUF */
+    size_t           cap;   /* Capacity of BUF */
+    path_cache       cache; /* Directory heatmap of the last path */
+};
 
-    if (*dest) {
-        hmfree(*dest);
+/**
+ * Return the bit of CH in a char-presence mask.
+ *
+ * Letters share a bit with their other case and digits get their own; the
+ * remaining chars share what is left.
+ */
+static uint64_t char_bit(char ch) {
+    unsigned char c = ch;
+    int           bit;
+
+    if (c >= 'a' && c <= 'z') {
+        bit = c - 'a';
+    } else if (c >= 'A' && c <= 'Z') {
+        bit = c - 'A';
+    } else if (c >= '0' && c <= '9') {
+        bit = 26 + (c - '0');
+    } else {
+        bit = 36 + (c % 28);
     }
-    *dest = NULL;
 
-    for (int i = 0; i < hmlen(src); ++i) {
-        int  key = src[i].key;
-        int* val = src[i].value;
-        hmput(*dest, key, val);
-    }
+    return (uint64_t)1 << bit;
 }
 
 /**
- * Clone the int* array.
+ * Return the number of bits set in BITS.
  */
-static void clone_arr_int(const int* src, int** dest) {
-    if (!src) {
-        return;
-    }
-
-    if (*dest) {
-        arrfree(*dest);
-    }
-    *dest = NULL;
+static int popcount(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(bits);
+#else
+    bits = bits - ((bits >> 1) & 0x5555555555555555ULL);
+    bits = (bits & 0x3333333333333333ULL) + ((bits >> 2) & 0x3333333333333333ULL);
+    bits = (bits + (bits >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((bits * 0x0101010101010101ULL) >> 56);
+#endif
+}
 
-    for (int i = 0; i < arrlen(src); ++i) {
-        arrput(*dest, src[i]);
-    }
+/**
+ * Return the index of the lowest set bit of the non-zero BITS.
+ */
+static int lowest_bit64(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(bits);
+#else
+    return popcount((bits & (0 - bits)) - 1);
+#endif
 }
 
 /**
- * Clone the flx_result* array.
+ * Return the bits of BITS from position FROM on.
  */
-static void clone_arr_result(const flx_result* src, flx_result** dest) {
-    if (*dest) {
-        arrfree(*dest);
-    }
-    *dest = NULL;
+static uint64_t bits_from(uint64_t bits, int from) {
+    return (from < SHORT_MAX) ? bits & (~(uint64_t)0 << from) : 0;
+}
 
-    for (int i = 0; i < arrlen(src); ++i) {
-        arrput(*dest, src[i]);
+/**
+ * Digest the LEN chars of QUERY into Q; Q borrows the string.
+ */
+static void init_query(flx_query* q, const char* query, size_t len) {
+    q->str              = query;
+    q->len              = (int)len;
+    q->full_match_boost = (1 < q->len) && (q->len < 5);
+    q->mask             = 0;
+    q->separator        = NIL;
+
+    for (int i = 0; i < q->len; ++i) {
+        q->mask |= char_bit(query[i]);
     }
 }
 
 /**
- * Free up memory for flx_result* array.
+ * Round SIZE up to the arena alignment.
  */
-static void free_arr_result(flx_result** src) {
-    if (*src) {
-        for (int i = 0; i < arrlen(*src); ++i) {
-            arrfree((*src)[i].indices);
-        }
-        arrfree(*src);
-    }
-    *src = NULL;
+static size_t align_size(size_t size) { return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1); }
+
+/**
+ * Start ARENA with the caller-provided BUF of SIZE bytes as its first block.
+ */
+static void arena_init(flx_arena* arena, void* buf, size_t size) {
+    flx_block* block = buf;
+    block->next      = NULL;
+    block->size      = size - align_size(sizeof(flx_block));
+    block->used      = 0;
+    block->owned     = false;
+
+    arena->head       = block;
+    arena->block_size = ARENA_BLOCK_SIZE;
 }
 
 /**
- * Check if CHAR is a word character.
+ * Declare ARENA, seeded with STACK_ARENA_SIZE bytes of the caller's stack.
+ * Release it with `arena_release`.
  */
-static bool word(char ch) {
-    if (ch == NIL) {
-        return false;
+#define STACK_ARENA(arena)                                          \
+    long long arena##_buf[STACK_ARENA_SIZE / sizeof(long long)];    \
+    flx_arena arena;                                                \
+    arena_init(&(arena), arena##_buf, sizeof(arena##_buf))
+
+/**
+ * Free the blocks of ARENA, but not ARENA itself.
+ */
+static void arena_release(flx_arena* arena) {
+    flx_block* block = arena->head;
+
+    while (block) {
+        flx_block* next = block->next;
+        if (block->owned) {
+            free(block);
+        }
+        block = next;
     }
-    return !strchr(word_separators, ch);
+
+    arena->head = NULL;
 }
 
 /**
- * Check if CHAR is an uppercase character.
+ * Make a new block of SIZE bytes the head of ARENA.
  */
-static bool capital(char ch) { return word(ch) && isupper(ch); }
+static flx_block* arena_push_block(flx_arena* arena, size_t size) {
+    flx_block* block = malloc(align_size(sizeof(flx_block)) + size);
+    block->next      = arena->head;
+    block->size      = size;
+    block->used      = 0;
+    block->owned     = true;
+    arena->head      = block;
+    return block;
+}
 
 /**
- * Check if LAST-CHAR is the end of a word and CHAR the start of the next.
- *
- * This function is camel-case aware.
+ * Allocate SIZE bytes from ARENA.
  */
-static bool boundary(char last_ch, char ch) {
-    if (!last_ch) {
-        return true;
-    }
+static void* arena_alloc(flx_arena* arena, size_t size) {
+    flx_block* block = arena->head;
 
-    if (!capital(last_ch) && capital(ch)) {
-        return true;
-    }
+    size = align_size(size);
 
-    if (!word(last_ch) && word(ch)) {
-        return true;
+    if (!block || block->size - block->used < size) {
+        block = arena_push_block(arena, (size < arena->block_size) ? arena->block_size : size);
     }
 
-    return false;
+    void* ptr = (char*)block + align_size(sizeof(flx_block)) + block->used;
+    block->used += size;
+    return ptr;
 }
 
 /**
- * Increment each element in VEC between BEG and END by INC.
+ * Allocate an array of COUNT elements of TYPE from ARENA.
  */
-static void inc_vec(int** vec, int inc, int beg, int end) {
-    inc = (inc == NIL) ? 1 : inc;
-    beg = (beg == NIL) ? 0 : beg;
-    end = (end == NIL) ? arrlen(*vec) : end;
+#define arena_array(arena, type, count) ((type*)arena_alloc((arena), sizeof(type) * (count)))
 
-    while (beg < end) {
-        (*vec)[beg] += inc;
-        ++beg;
+/**
+ * Check if CHAR is a word character.
+ */
+static bool word(char ch) {
+    if (ch == NIL) {
+        return false;
     }
+    return !strchr(word_separators, ch);
 }
 
 /**
- * Return hash-table for string where keys are characters.
- * Value is a sorted list of indexes for character occurrences.
+ * Check if CHAR is an uppercase character.
  */
-static void get_hash_for_string(hm_int** result, const char* str) {
-    if (*result) {
-        hmfree(*result);
-    }
-    *result = NULL;
+static bool capital(char ch) { return word(ch) && isupper(ch); }
+
+/**
+ * Build the char index of CAND from STR, where keys are characters.
+ * Each key owns a sorted list of indexes for character occurrences.
+ */
+static void get_hash_for_string(flx_arena* arena, flx_candidate* cand, const char* str) {
+    const int str_len = cand->len;
 
-    const int str_len = strlen(str);
-    int       index   = str_len - 1;
+    int counts[UCHAR_MAX + 1] = {0};
+    int total                 = 0;
 
     char ch;
     char down_ch;
 
-    while (0 <= index) {
+    for (int index = 0; index < str_len; ++index) {
         ch = str[index];
 
         if (capital(ch)) {
-            insert_dict(result, ch, index);
+            ++counts[(unsigned char)ch];
+            ++total;
             down_ch = tolower(ch);
         } else {
             down_ch = ch;
         }
 
-        insert_dict(result, down_ch, index);
+        ++counts[(unsigned char)down_ch];
+        ++total;
+    }
 
-        --index;
+    cand->mask     = 0;
+    cand->keys_len = 0;
+    for (int key = 0; key <= UCHAR_MAX; ++key) {
+        cand->keys_len += (counts[key] != 0);
     }
-}
 
-/**
- * Generate the heatmap vector of string.
- *
- * See documentation for logic.
- */
-static void get_heatmap_str(int** scores, const char* str, char group_separator) {
-    const int str_len        = strlen(str);
-    const int str_last_index = str_len - 1;
+    cand->offsets   = arena_array(arena, int, cand->keys_len + 1);
+    cand->positions = arena_array(arena, int, total);
 
-    if (*scores) {
-        arrfree(*scores);
-    }
-    *scores = NULL;
+    // Turn the counts into the write cursor of each key.
+    int offset = 0;
+    int k      = 0;
 
-    for (int i = 0; i < str_len; ++i) {
-        arrput(*scores, default_score);
-    }
+    for (int word = 0; word < 4; ++word) {
+        uint64_t bits = 0;
 
-    int penalty_lead = '.';
+        cand->ranks[word] = k;
 
-    int* inner = NULL;
-    arrput(inner, -1);
-    arrput(inner, 0);
+        for (int key = word * 64; key < (word + 1) * 64; ++key) {
+            if (counts[key] == 0) {
+                continue;
+            }
 
-    int** group_alist = NULL;
-    arrput(group_alist, inner);
+            bits |= (uint64_t)1 << (key % 64);
+            cand->offsets[k] = offset;
+            cand->mask |= char_bit(key);
+            ++k;
 
-    // final char bonus
-    (*scores)[str_last_index] += 1;
+            offset += counts[key];
+            counts[key] = offset - counts[key];
+        }
+
+        cand->keys[word] = bits;
+    }
+    cand->offsets[k] = offset;
+
+    for (int index = 0; index < str_len; ++index) {
+        ch = str[index];
+
+        if (capital(ch)) {
+            cand->positions[counts[(unsigned char)ch]++] = index;
+            down_ch                                      = tolower(ch);
+        } else {
+            down_ch = ch;
+        }
 
-    // Establish baseline mapping
-    char last_ch          = NIL;
-    int  group_word_count = 0;
-    int  index1           = 0;
+        cand->positions[counts[(unsigned char)down_ch]++] = index;
+    }
+}
+
+/**
+ * Generate the heatmap vector of STR as the tail of a longer string, after
+ * GROUPS_BEFORE groups of it closed by GROUP_SEPARATOR.  The tail scores as
+ * it does in the whole string, as long as it holds the basepath.
+ */
+static int* get_heatmap_groups(flx_arena* arena, const char* str, int str_len,
+                               char group_separator, int groups_before) {
+    int* scores = arena_array(arena, int, str_len);
+
+    // The first pass scores each char on its own and within its word; the
+    // second adds what each group earns, which needs the whole string.
+    char last_ch      = NIL;
+    bool last_word    = false;
+    bool last_capital = false;
+
+    int separator_count  = 0;
+    int group_word_count = 0; // word groups of the current group
+    int group_words      = 0; // word starts of the current group
+    int last_word_count  = 0; // word groups of the group before
+    int word_index       = -1;
+    int word_start       = 0;
 
     for (int i = 0; i < str_len; ++i) {
-        char ch = str[i];
+        char ch         = str[i];
+        bool is_word    = word(ch);
+        bool is_capital = is_word && isupper(ch);
+        int  score      = default_score;
 
         // before we find any words, all separaters are
         // considered words of length 1.  This is so "foo/__ab"
         // gets penalized compared to "foo/ab".
-        char effective_last_char = (group_word_count == 0) ? 0 : last_ch;
+        if (group_word_count == 0 || !last_ch || (!last_capital && is_capital) ||
+            (!last_word && is_word)) {
+            ++word_index;
+            ++group_words;
+            word_start = i;
 
-        if (boundary(effective_last_char, ch)) {
-            arrins(group_alist[0], 2, index1);
+            // ++++  beg word bonus AND
+            score += 85;
         }
 
-        if (!word(last_ch) && word(ch)) {
+        score += (-3 * word_index) - // ++++ word order penalty
+                 (i - word_start);   // ++++ char order penalty
+
+        if (!last_word && is_word) {
             ++group_word_count;
         }
 
         // ++++ -45 penalize extension
-        if (last_ch && last_ch == penalty_lead) {
-            (*scores)[index1] += -45;
+        if (last_ch == '.') {
+            score += -45;
         }
 
         if (group_separator != NIL && group_separator == ch) {
-            group_alist[0][1] = group_word_count;
-            group_word_count  = 0;
-            {
-                int* new_arr = NULL;
-                arrput(new_arr, index1);
-                arrput(new_arr, group_word_count);
-                arrins(group_alist, 0, new_arr);
-            }
+            ++separator_count;
+            last_word_count  = group_word_count;
+            group_word_count = 0;
+            group_words      = 0;
+            word_index       = -1;
         }
 
-        if (index1 == str_last_index) {
-            group_alist[0][1] = group_word_count;
-        } else {
-            last_ch = ch;
-        }
+        scores[i] = score;
 
-        ++index1;
+        last_ch      = ch;
+        last_word    = is_word;
+        last_capital = is_capital;
     }
 
-    int group_count     = arrlen(group_alist);
-    int separator_count = group_count - 1;
-
-    // ++++ slash group-count penalty
-    if (separator_count != 0) {
-        inc_vec(scores, group_count * -2, NIL, NIL);
-    }
+    // final char bonus
+    scores[str_len - 1] += 1;
 
-    int  index2           = separator_count;
-    int  last_group_limit = NIL;
-    //bool basepath_found   = false;
+    // Only the last group with words is the basepath.  Every group but the
+    // last starts with a word, so that is the last group unless the string
+    // ends with a separator.
+    separator_count += groups_before;
 
-    // score each group further
-    for (int i = 0; i < arrlen(group_alist); ++i) {
-        int* group = group_alist[i];
+    int group_count    = separator_count + 1;
+    int basepath       = (group_words != 0) ? group_count - 1 : group_count - 2;
+    int basepath_words = (group_words != 0) ? group_word_count : last_word_count;
 
-        int group_start = group[0];
-        int word_count  = group[1];
-        // this is the number of effective word groups
-        int  words_len  = arrlen(group) - 2;
-        bool basepath_p = false;
+    // ++++ slash group-count penalty
+    int penalty = (separator_count != 0) ? group_count * -2 : 0;
 
-        if (words_len != 0 && !basepath_p) {
-            //basepath_found = true;
-            basepath_p     = true;
-        }
+    // ++++ basepath separator-count boosts
+    int boosts = (separator_count > 1) ? separator_count - 1 : 0;
 
+    for (int i = 0, g = groups_before; i < str_len; ++i) {
         int num;
-        if (basepath_p) {
-            // ++++ basepath separator-count boosts
-            int boosts = 0;
-            if (separator_count > 1) {
-                boosts = separator_count - 1;
-            }
-
+        if (g == basepath) {
             // ++++ basepath word count penalty
-            int penalty = -word_count;
-            num         = 35 + boosts + penalty;
+            num = 35 + boosts - basepath_words;
         }
         // ++++ non-basepath penalties
         else {
-            if (index2 == 0) {
-                num = -3;
-            } else {
-                num = -5 + (index2 - 1);
-            }
+            num = (g == 0) ? -3 : -5 + (g - 1);
         }
 
-        //int len = arrlen(*scores);
+        // A group's increment of 0 has always counted as 1.
+        scores[i] += penalty + ((num == 0) ? 1 : num);
 
-        inc_vec(scores, num, group_start + 1, last_group_limit);
+        // A separator closes its group.
+        if (group_separator != NIL && group_separator == str[i]) {
+            ++g;
+        }
+    }
+
+    return scores;
+}
 
-        int* cddr_group = NULL;
-        clone_arr_int(group, &cddr_group);
-        arrdel(cddr_group, 0);
-        arrdel(cddr_group, 0);
+/**
+ * Generate the heatmap vector of string.
+ *
+ * See documentation for logic.
+ */
+static int* get_heatmap_str(flx_arena* arena, const char* str, int str_len, char group_separator) {
+    return get_heatmap_groups(arena, str, str_len, group_separator, 0);
+}
 
-        int word_index = words_len - 1;
-        int last_word  = (last_group_limit) ? last_group_limit : str_len;
+/**
+ * Release the memory of CACHE.
+ */
+static void path_cache_release(path_cache* cache) {
+    free(cache->dir);
+    free(cache->heatmap);
+}
 
-        for (int i = 0; i < arrlen(cddr_group); ++i) {
-            int word = cddr_group[i];
+/**
+ * Generate the heatmap vector of path STR, whose groups are split by
+ * SEPARATOR, reusing the directory part from CACHE when it is unchanged.
+ *
+ * Scores of the groups before the basename depend on nothing after them, as
+ * long as the basename is not empty and so is the basepath.  The basename
+ * scores as the tail of the whole path.
+ */
+static int* get_heatmap_path(flx_arena* arena, path_cache* cache, const char* str, int str_len,
+                             char separator) {
+    int dir_len = str_len;
 
-            // ++++  beg word bonus AND
-            (*scores)[word] += 85;
+    while (dir_len > 0 && str[dir_len - 1] != separator) {
+        --dir_len;
+    }
 
-            int index3 = word;
-            int charI  = 0;
+    if (cache == NULL || dir_len == 0 || dir_len == str_len) {
+        return get_heatmap_str(arena, str, str_len, separator);
+    }
 
-            while (index3 < last_word) {
-                (*scores)[index3] += (-3 * word_index) - // ++++ word order penalty
-                                     charI;              // ++++ char order penalty
-                ++charI;
-                ++index3;
-            }
+    if (cache->dir_len != dir_len || memcmp(cache->dir, str, dir_len) != 0) {
+        int* scores = get_heatmap_str(arena, str, str_len, separator);
 
-            last_word = word;
-            --word_index;
+        if (cache->cap < dir_len) {
+            cache->cap     = dir_len * 2;
+            cache->dir     = realloc(cache->dir, cache->cap);
+            cache->heatmap = realloc(cache->heatmap, sizeof(int) * cache->cap);
         }
 
-        last_group_limit = group_start + 1;
-        --index2;
+        memcpy(cache->dir, str, dir_len);
+        memcpy(cache->heatmap, scores, sizeof(int) * dir_len);
+        cache->dir_len    = dir_len;
+        cache->separators = 0;
 
-        arrfree(cddr_group);
-    }
+        for (int i = 0; i < dir_len; ++i) {
+            cache->separators += (str[i] == separator);
+        }
 
-    for (int i = 0; i < arrlen(group_alist); ++i) {
-        arrfree(group_alist[i]);
+        return scores;
     }
-    arrfree(group_alist);
+
+    int* scores = arena_array(arena, int, str_len);
+    int* base   = get_heatmap_groups(arena, str + dir_len, str_len - dir_len, separator,
+                                     cache->separators);
+
+    memcpy(scores, cache->heatmap, sizeof(int) * dir_len);
+    memcpy(scores + dir_len, base, sizeof(int) * (str_len - dir_len));
+
+    return scores;
 }
 
 /**
- * Return sublist bigger than VAL from sorted SORTED-LIST.
+ * Return the sorted positions of CH in CAND and store their number in COUNT.
  *
- * If VAL is nil, return entire list.
+ * The keys of the chars below CH are counted in the key bit set, which gives
+ * the slot of CH in the offsets directly.
  */
-static void bigger_sublist(int** result, int** sorted_list, int val) {
-    if (*sorted_list == NULL) {
-        return;
-    }
+static const int* get_positions(const flx_candidate* cand, char ch, int* count) {
+    unsigned char key  = ch;
+    uint64_t      word = cand->keys[key / 64];
+    uint64_t      bit  = (uint64_t)1 << (key % 64);
 
-    if (val) {
-        for (int i = 0; i < arrlen(*sorted_list); ++i) {
-            int sub = (*sorted_list)[i];
-            if (sub > val) {
-                arrput(*result, sub);
-            }
-        }
-    } else {
-        for (int i = 0; i < arrlen(*sorted_list); ++i) {
-            int sub = (*sorted_list)[i];
-            arrput(*result, sub);
-        }
+    if (!(word & bit)) {
+        *count = 0;
+        return NULL;
     }
+
+    int k  = cand->ranks[key / 64] + popcount(word & (bit - 1));
+    *count = cand->offsets[k + 1] - cand->offsets[k];
+    return cand->positions + cand->offsets[k];
 }
 
 /**
- * Recursively compute the best match for a string, passed as STR_INFO and
- * HEATMAP, according to QUERY.
+ * Value of a position that cannot start a match of the query suffix.
  */
-static void find_best_match(flx_result** imatch, hm_int** str_info, int** heatmap, int greater_than,
-                            const char* query, int query_len, int q_index, hm_score** match_cache) {
-    int         greater_num = (greater_than == NIL) ? 0 : greater_than;
-    int         hash_key    = q_index + (greater_num * query_len);
-    flx_result* hash_value  = hmget(*match_cache, hash_key);
+#define NONE INT_MIN
 
-    // Process matchCache here
-    if (hash_value != NULL) {
-        free_arr_result(imatch);
+/**
+ * @struct Cell of the match table: the best score of the query suffix matched
+ * from a position, and the contiguous matches that follow it.
+ */
+typedef struct {
+    int score;
+    int tail;
+} match_cell;
 
-        for (int i = 0; i < hmlen(hash_value); ++i) {
-            flx_result val = hash_value[i];
-            arrput(*imatch, val);
-        }
-    } else {
-        int  uchar       = query[q_index];
-        int* sorted_list = hmget(*str_info, uchar);
-        int* indexes     = NULL;
-        bigger_sublist(&indexes, &sorted_list, greater_than);
-        int temp_score;
-        int best_score = INT_MIN;
-
-        if (q_index >= query_len - 1) {
-            // At the tail end of the recursion, simply generate all possible
-            // matches with their scores and return the list to parent.
-            for (int i = 0; i < arrlen(indexes); ++i) {
-                int  index   = indexes[i];
-                int* indices = NULL;
-                arrput(indices, index);
-                flx_result new_res = new_result(indices, (*heatmap)[index], 0);
-                arrput(*imatch, new_res);
+/**
+ * Compute the best match for the prepared CAND according to QUERY.
+ *
+ * The search runs bottom-up over tables with one row per query char and one
+ * column per string position, from the last query char to the first,
+ * and picks the same match as the recursive flx algorithm: a query char only
+ * sees the best match of the rest of the query, except for the second to last
+ * one, which sees every position of the last char and so can favour a
+ * contiguous one.
+ *
+ * NOTE: As in the recursive search, a char matched at position 0 does not
+ * constrain the next one, which may match position 0 again.
+ *
+ * Unless REACH is NULL, the search gives up as soon as no match can score
+ * above FLOOR: REACH[q] bounds what the chars before q can add to the best
+ * score in row q (see `score_bound`).
+ */
+static bool find_best_match(flx_arena* arena, flx_result_buf* out, const flx_candidate* cand,
+                            const flx_query* q, const int* reach, int floor) {
+    const int*  heatmap   = cand->heatmap;
+    const int   str_len   = cand->len;
+    const char* query     = q->str;
+    const int   query_len = q->len;
+
+    // A row only reads the one below, so two rolling rows of cells are
+    // enough.  Without room for indices only the score is wanted; with it,
+    // each row also keeps the position of the next query char of its cells,
+    // an int per position rather than a whole cell.
+    const bool track = (out->indices != NULL && out->capacity > 0);
+    const int  cells = min(query_len, 2) * str_len;
+
+    // The whole table comes in one block: the cells, then the suffix argmax
+    // over the row below, then the back pointers when indices are tracked.
+    size_t      ints  = str_len + 1 + (track ? (size_t)query_len * str_len : 0);
+    match_cell* table = arena_alloc(arena, sizeof(match_cell) * cells + sizeof(int) * ints);
+    int*        best  = (int*)(table + cells);
+    int*        nexts = track ? best + str_len + 1 : NULL;
+
+    // Only the cells at the positions of a row's char are ever written or
+    // read, so each row costs the positions of its char and of the one below
+    // rather than the length of the string.
+    const int* below_list  = NULL;
+    int        below_count = 0;
+
+    for (int q_index = query_len - 1; q_index >= 0; --q_index) {
+        match_cell*       cell  = table + (q_index & 1) * str_len;
+        const match_cell* below = table + ((q_index + 1) & 1) * str_len;
+        int*              next  = track ? nexts + q_index * str_len : NULL;
+
+        bool last = (q_index == query_len - 1);
+
+        if (!last) {
+            // best[t] is the first of the positions below from the t-th on
+            // with the highest score, as an index into BELOW_LIST.
+            best[below_count] = -1;
+            for (int t = below_count - 1; t >= 0; --t) {
+                int i   = below_list[t];
+                int j   = best[t + 1];
+                best[t] = (below[i].score != NONE &&
+                           (j == -1 || below[i].score >= below[below_list[j]].score))
+                                  ? t
+                                  : j;
             }
-        } else {
-            for (int i = 0; i < arrlen(indexes); ++i) {
-                int index = indexes[i];
-
-                flx_result* elem_group = NULL;
-
-                hm_int* new_dic = NULL;
-                clone_hm_int(*str_info, &new_dic);
+        }
 
-                int* new_vec = NULL;
-                clone_arr_int(*heatmap, &new_vec);
+        int        count;
+        const int* sorted_list = get_positions(cand, query[q_index], &count);
+        int        row_best    = NONE;
+        // First of the positions below at or after FROM; FROM only grows.
+        int        cursor      = 0;
 
-                find_best_match(&elem_group, &new_dic, &new_vec, index, query, query_len,
-                                q_index + 1, match_cache);
+        for (int k = 0; k < count; ++k) {
+            int index = sorted_list[k];
 
-                for (int j = 0; j < arrlen(elem_group); ++j) {
-                    flx_result elem = elem_group[j];
+            if (last) {
+                cell[index].score = heatmap[index];
+                cell[index].tail  = 0;
+                if (track) {
+                    next[index] = -1;
+                }
+                if (heatmap[index] > row_best) {
+                    row_best = heatmap[index];
+                }
+                continue;
+            }
 
-                    int caar = elem.indices[0];
-                    int cadr = elem.score;
-                    int cddr = elem.tail;
+            int from       = (index == 0) ? 0 : index + 1;
+            int best_index = -1;
+            int best_score = NONE;
+            int best_tail  = 0;
 
-                    if ((caar - 1) == index) {
-                        temp_score = cadr + (*heatmap)[index] +
-                                     (min(cddr, 3) * 15) + // boost contiguous matches
-                                     60;
-                    } else {
-                        temp_score = cadr + (*heatmap)[index];
-                    }
+            while (cursor < below_count && below_list[cursor] < from) {
+                ++cursor;
+            }
 
-                    // We only care about the optimal match, so only forward the match
-                    // with the best score to parent
-                    if (temp_score > best_score) {
-                        best_score = temp_score;
+            if (q_index == query_len - 2) {
+                // Every position of the last char is a candidate, in order.
+                int adjacent = index + 1;
+                int after    = cursor;
 
-                        free_arr_result(imatch);
+                if (from < adjacent && after < below_count && below_list[after] == from) {
+                    best_index = from;
+                    best_score = below[from].score;
+                    ++after;
+                }
 
-                        int* indices = NULL;
-                        clone_arr_int(elem.indices, &indices);
+                if (after < below_count && below_list[after] == adjacent) {
+                    if (below[adjacent].score + 60 > best_score) {
+                        best_index = adjacent;
+                        best_score = below[adjacent].score + 60;
+                        best_tail  = 1;
+                    }
+                    ++after;
+                }
 
-                        arrins(indices, 0, index);
-                        int tail = 0;
-                        if ((caar - 1) == index) {
-                            tail = cddr + 1;
-                        }
+                int j = best[after];
 
-                        flx_result new_res = new_result(indices, temp_score, tail);
-                        arrput(*imatch, new_res);
+                if (j != -1 && below[below_list[j]].score > best_score) {
+                    best_index = below_list[j];
+                    best_score = below[best_index].score;
+                    best_tail  = 0;
+                }
+            } else {
+                // Only the best match of the rest of the query is a candidate.
+                int j = best[cursor];
+
+                if (j != -1) {
+                    best_index = below_list[j];
+                    best_score = below[best_index].score;
+                    int cddr   = below[best_index].tail;
+
+                    if ((best_index - 1) == index) {
+                        best_score += (min(cddr, 3) * 15) + // boost contiguous matches
+                                      60;
+                        best_tail = cddr + 1;
                     }
                 }
+            }
+
+            if (best_index == -1) {
+                cell[index].score = NONE;
+                continue;
+            }
 
-                free_arr_result(&elem_group);
-                hmfree(new_dic);
-                arrfree(new_vec);
+            cell[index].score = best_score + heatmap[index];
+            cell[index].tail  = best_tail;
+            if (track) {
+                next[index] = best_index;
+            }
+
+            if (cell[index].score > row_best) {
+                row_best = cell[index].score;
             }
         }
 
-        arrfree(indexes);
+        below_list  = sorted_list;
+        below_count = count;
 
-        // Calls are cached to avoid exponential time complexity
-        flx_result* new_res = NULL;
-        clone_arr_result(*imatch, &new_res);
-        hmput(*match_cache, hash_key, new_res);
+        // A row with no match ends every match; a row whose best cannot
+        // climb above FLOOR ends every winning one.
+        if (row_best == NONE || (reach != NULL && row_best + reach[q_index] <= floor)) {
+            return false;
+        }
     }
-}
 
-/*
- * Free internal memories.
- */
-static void free_internal(flx_result** optimal_match, hm_int** str_info, int** heatmap,
-                          hm_score** match_cache) {
-    arrfree(*heatmap);
+    // Pick the start of the match.
+    int        count;
+    const int* sorted_list = get_positions(cand, query[0], &count);
+    int        start       = -1;
 
-    // NOTE: The first one will be free in function `flx_free`.
-    for (int i = 1; i < arrlen(*optimal_match); ++i) {
-        arrfree((*optimal_match)[i].indices);
-    }
-    arrfree(*optimal_match);
+    for (int k = 0; k < count; ++k) {
+        int index = sorted_list[k];
 
-    for (int i = 0; i < hmlen(*str_info); ++i) {
-        arrfree((*str_info)[i].value);
-    }
-    hmfree(*str_info);
+        if (table[index].score == NONE) {
+            continue;
+        }
 
-    for (int i = 0; i < hmlen(*match_cache); ++i) {
-        arrfree((*match_cache)[i].value);
+        // With a single char, every position is a full match; take the first.
+        if (start == -1 || (query_len > 1 && table[index].score > table[start].score)) {
+            start = index;
+        }
     }
-    hmfree(*match_cache);
-}
 
-/**
- * Free result.
- * @param *result The score result to free.
- */
-void flx_free(flx_result* result) {
-    if (!result) {
-        return;
+    if (start == -1) {
+        return false;
     }
 
-    if (result->indices != NULL) {
-        arrfree(result->indices);
+    out->score = table[start].score;
+    out->tail  = table[start].tail;
+    out->len   = query_len;
+
+    int index = start;
+    for (int q_index = 0; track && q_index < query_len && q_index < out->capacity; ++q_index) {
+        out->indices[q_index] = index;
+        index                 = nexts[q_index * str_len + index];
     }
 
-    free(result);
+    return true;
 }
 
 /**
- * Return best score matching QUERY against STR.
- * @param *str String to test.
- * @param *query Query use to score.
+ * Check if query char QCH matches CH; the same test the char index encodes.
  */
-flx_result* flx_score(const char* str, const char* query) {
-    flx_result* result = malloc(1 * sizeof(*result));
-    result->indices    = NULL;
+static bool char_match(char qch, char ch) { return ch == qch || (tolower(ch) == qch && capital(ch)); }
 
-    const int str_len   = strlen(str);
-    const int query_len = strlen(query);
+#if defined(__AVX2__) || defined(FLX_SSE2)
+/**
+ * Return the uppercase char that also matches query char QCH, or QCH itself.
+ */
+static char upper_match(char qch) {
+    char up = toupper(qch);
+    return (up != qch && char_match(qch, up)) ? up : qch;
+}
 
-    if (str_len == 0 || query_len == 0) {
-        flx_free(result);
-        return NULL;
-    }
+/**
+ * Return the index of the lowest set bit of the non-zero MASK.
+ */
+static int lowest_bit(unsigned mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
 
-    hm_int* str_info = NULL;
-    get_hash_for_string(&str_info, str);
+/**
+ * Return the first position from INDEX on whose char matches query char QCH,
+ * or -1.
+ *
+ * The vector loops compare a whole block against QCH and its uppercase at
+ * once.  Non-ASCII bytes are flagged as well and checked one by one, since the
+ * locale decides how those fold.
+ */
+static int find_char(const char* str, int index, int str_len, char qch) {
+#if defined(__AVX2__) || defined(FLX_SSE2)
+    const char up = upper_match(qch);
+#endif
 
-    int* heatmap = NULL;
-    get_heatmap_str(&heatmap, str, NIL);
+#if defined(__AVX2__)
+    const __m256i lower = _mm256_set1_epi8(qch);
+    const __m256i upper = _mm256_set1_epi8(up);
 
-    bool        full_match_boost = (1 < query_len) && (query_len < 5);
-    hm_score*   match_cache      = NULL;
-    flx_result* optimal_match    = NULL;
-    find_best_match(&optimal_match, &str_info, &heatmap, NIL, query, query_len, 0, &match_cache);
+    for (; index + 32 <= str_len; index += 32) {
+        __m256i  chunk = _mm256_loadu_si256((const __m256i*)(str + index));
+        __m256i  hit   = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, lower),
+                                         _mm256_cmpeq_epi8(chunk, upper));
+        unsigned mask  = (unsigned)_mm256_movemask_epi8(hit) | (unsigned)_mm256_movemask_epi8(chunk);
 
-    if (arrlen(optimal_match) == 0) {
-        free_internal(&optimal_match, &str_info, &heatmap, &match_cache);
-        flx_free(result);
-        return NULL;
+        for (; mask != 0; mask &= mask - 1) {
+            int found = index + lowest_bit(mask);
+            if (char_match(qch, str[found])) {
+                return found;
+            }
+        }
     }
+#elif defined(FLX_SSE2)
+    const __m128i lower = _mm_set1_epi8(qch);
+    const __m128i upper = _mm_set1_epi8(up);
+
+    for (; index + 16 <= str_len; index += 16) {
+        __m128i  chunk = _mm_loadu_si128((const __m128i*)(str + index));
+        __m128i  hit   = _mm_or_si128(_mm_cmpeq_epi8(chunk, lower), _mm_cmpeq_epi8(chunk, upper));
+        unsigned mask  = (unsigned)_mm_movemask_epi8(hit) | (unsigned)_mm_movemask_epi8(chunk);
+
+        for (; mask != 0; mask &= mask - 1) {
+            int found = index + lowest_bit(mask);
+            if (char_match(qch, str[found])) {
+                return found;
+            }
+        }
+    }
+#endif
+
+    for (; index < str_len; ++index) {
+        if (char_match(qch, str[index])) {
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Match QUERY from Q_INDEX on greedily against the chars of STR from INDEX up
+ * to END, and return the index of the first query char left unmatched.
+ *
+ * Scanning a string in pieces gives the same result as scanning it at once.
+ *
+ * NOTE: Chars matched at position 0 leave the next char unconstrained (see
+ * `find_best_match`), so a leading run of the query may all sit there.
+ */
+static int advance_query(const char* str, int index, int end, const flx_query* query,
+                         int q_index) {
+    if (index == 0 && end > 0) {
+        while (q_index < query->len && char_match(query->str[q_index], str[0])) {
+            ++q_index;
+        }
+
+        index = 1;
+    }
+
+    for (; q_index < query->len; ++q_index) {
+        index = find_char(str, index, end, query->str[q_index]);
+
+        if (index == -1) {
+            break;
+        }
+
+        ++index;
+    }
+
+    return q_index;
+}
+
+/**
+ * Return true if QUERY can match STR at all, without building anything.
+ */
+static bool is_subsequence(const char* str, int str_len, const flx_query* query) {
+    return advance_query(str, 0, str_len, query, 0) == query->len;
+}
+
+/**
+ * Return the first of the COUNT sorted POSITIONS greater than VAL, or -1.
+ */
+static int next_position(const int* positions, int count, int val) {
+    int lo = 0;
+    int hi = count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (positions[mid] > val) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return (lo < count) ? positions[lo] : -1;
+}
+
+/**
+ * Return true if QUERY can match the prepared CAND at all.
+ *
+ * The heatmap of CAND is built for one mode, so a path query only matches a
+ * path candidate and a plain query a plain one.  The char-presence masks
+ * reject most other candidates with a single AND.
+ */
+static bool can_match(const flx_candidate* cand, const flx_query* query) {
+    if (cand->separator != query->separator || (query->mask & ~cand->mask) != 0) {
+        return false;
+    }
+
+    int        q_index = 0;
+    int        count;
+    const int* positions;
+
+    // See `is_subsequence` for the leading run at position 0.
+    while (q_index < query->len) {
+        positions = get_positions(cand, query->str[q_index], &count);
+        if (count == 0 || positions[0] != 0) {
+            break;
+        }
+        ++q_index;
+    }
+
+    for (int last = 0; q_index < query->len; ++q_index) {
+        positions = get_positions(cand, query->str[q_index], &count);
+        last      = next_position(positions, count, last);
+
+        if (last == -1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Compute into BOUND a score no match of QUERY against the prepared CAND can
+ * exceed.  Return false if some query char does not occur at all.
+ *
+ * Every query char takes at most the hottest of its positions, and the n-th
+ * pair of neighbours from the end at most `min(n, 3) * 15 + 60` for
+ * contiguity.  Unless REACH is NULL, REACH[q] receives the most the chars
+ * before q can add to a match of the rest of the query.
+ */
+static bool score_bound(const flx_candidate* cand, const flx_query* query, int* reach,
+                        int* bound) {
+    int total = 0;
+
+    for (int q_index = 0; q_index < query->len; ++q_index) {
+        if (reach != NULL) {
+            reach[q_index] = total;
+        }
+
+        int        count;
+        const int* positions = get_positions(cand, query->str[q_index], &count);
+
+        if (count == 0) {
+            return false;
+        }
+
+        int hottest = cand->heatmap[positions[0]];
+
+        for (int k = 1; k < count; ++k) {
+            if (cand->heatmap[positions[k]] > hottest) {
+                hottest = cand->heatmap[positions[k]];
+            }
+        }
+
+        total += hottest;
+
+        if (q_index < query->len - 1) {
+            total += (min(query->len - 2 - q_index, 3) * 15) + 60;
+        }
+    }
+
+    if (query->full_match_boost && query->len == cand->len) {
+        total += 10000;
+    }
+
+    *bound = total;
+    return true;
+}
+
+/**
+ * Return the bits of the positions of the SHORT_MAX bytes of BLOCK that
+ * hold CH.
+ */
+static uint64_t block_eq(const char* block, char ch) {
+#if defined(__AVX2__)
+    const __m256i needle = _mm256_set1_epi8(ch);
+    __m256i       lo     = _mm256_loadu_si256((const __m256i*)block);
+    __m256i       hi     = _mm256_loadu_si256((const __m256i*)(block + 32));
+
+    return (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle)) |
+           ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle)) << 32);
+#elif defined(FLX_SSE2)
+    const __m128i needle = _mm_set1_epi8(ch);
+    uint64_t      bits   = 0;
+
+    for (int i = 0; i < SHORT_MAX / 16; ++i) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(block + 16 * i));
+        bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)) << (16 * i);
+    }
+
+    return bits;
+#else
+    uint64_t bits = 0;
+
+    for (int i = 0; i < SHORT_MAX; ++i) {
+        bits |= (uint64_t)(block[i] == ch) << i;
+    }
+
+    return bits;
+#endif
+}
+
+/**
+ * Fill MASKS with the positions of each QUERY char in the STR_LEN chars of
+ * STR, matched as the char index would (see `get_hash_for_string`).
+ *
+ * A query char matches a char either as is or, for a capital, lowercased; so
+ * comparing against the string and its lowercased capitals covers both.
+ */
+static void short_masks(const char* str, int str_len, const flx_query* query, uint64_t* masks) {
+    char     text[SHORT_MAX] = {0};
+    char     down[SHORT_MAX] = {0};
+    uint64_t used = (str_len == SHORT_MAX) ? ~(uint64_t)0 : ((uint64_t)1 << str_len) - 1;
+
+    for (int i = 0; i < str_len; ++i) {
+        text[i] = str[i];
+        down[i] = capital(str[i]) ? tolower(str[i]) : str[i];
+    }
+
+    for (int q_index = 0; q_index < query->len; ++q_index) {
+        char qch = query->str[q_index];
+
+        masks[q_index] = (block_eq(text, qch) | block_eq(down, qch)) & used;
+    }
+}
+
+/**
+ * Fill MASKS with the positions of each QUERY char in the short prepared
+ * CAND.
+ */
+static void short_masks_candidate(const flx_candidate* cand, const flx_query* query,
+                                  uint64_t* masks) {
+    for (int q_index = 0; q_index < query->len; ++q_index) {
+        int        count;
+        const int* positions = get_positions(cand, query->str[q_index], &count);
+
+        masks[q_index] = 0;
+
+        for (int k = 0; k < count; ++k) {
+            masks[q_index] |= (uint64_t)1 << positions[k];
+        }
+    }
+}
+
+/**
+ * Same as `score_bound` with the positions of each query char in MASKS.
+ */
+static bool short_bound(const int* heatmap, int str_len, const uint64_t* masks,
+                        const flx_query* query, int* reach, int* bound) {
+    int total = 0;
+
+    for (int q_index = 0; q_index < query->len; ++q_index) {
+        if (reach != NULL) {
+            reach[q_index] = total;
+        }
+
+        if (masks[q_index] == 0) {
+            return false;
+        }
+
+        int hottest = NONE;
+
+        for (uint64_t bits = masks[q_index]; bits != 0; bits &= bits - 1) {
+            int index = lowest_bit64(bits);
+
+            if (heatmap[index] > hottest) {
+                hottest = heatmap[index];
+            }
+        }
+
+        total += hottest;
+
+        if (q_index < query->len - 1) {
+            total += (min(query->len - 2 - q_index, 3) * 15) + 60;
+        }
+    }
+
+    if (query->full_match_boost && query->len == str_len) {
+        total += 10000;
+    }
+
+    *bound = total;
+    return true;
+}
+
+/**
+ * Same as `find_best_match` for a string of at most SHORT_MAX chars, with the
+ * positions of each query char in MASKS.
+ *
+ * A row of the table fits in a word: its positions are enumerated by their
+ * bits, and the positions below that may follow one are found by masking.
+ * Two rolling rows live on the stack.
+ */
+static bool find_best_match_short(flx_arena* arena, flx_result_buf* out, const int* heatmap,
+                                  const uint64_t* masks, const flx_query* q, const int* reach,
+                                  int floor) {
+    const int query_len = q->len;
+    const bool track    = (out->indices != NULL && out->capacity > 0);
+
+    match_cell   rows[2][SHORT_MAX];
+    signed char* nexts = track ? arena_array(arena, signed char, query_len * SHORT_MAX) : NULL;
+    // best[i] is the first position >= i with the highest score below, for
+    // each position i below that starts a match.
+    int          best[SHORT_MAX];
+    // Positions of the row below that start a match of the rest of the query.
+    uint64_t     valid = 0;
+
+    for (int q_index = query_len - 1; q_index >= 0; --q_index) {
+        match_cell*       cell  = rows[q_index & 1];
+        const match_cell* below = rows[(q_index + 1) & 1];
+        signed char*      next  = track ? nexts + q_index * SHORT_MAX : NULL;
+
+        bool     last      = (q_index == query_len - 1);
+        uint64_t row_valid = 0;
+        int      row_best  = NONE;
+
+        if (!last) {
+            int list[SHORT_MAX];
+            int count = 0;
+
+            for (uint64_t bits = valid; bits != 0; bits &= bits - 1) {
+                list[count++] = lowest_bit64(bits);
+            }
+
+            for (int t = count - 1, j = -1; t >= 0; --t) {
+                int i   = list[t];
+                best[i] = (j == -1 || below[i].score >= below[j].score) ? i : j;
+                j       = best[i];
+            }
+        }
+
+        for (uint64_t bits = masks[q_index]; bits != 0; bits &= bits - 1) {
+            int index = lowest_bit64(bits);
+
+            if (last) {
+                cell[index].score = heatmap[index];
+                cell[index].tail  = 0;
+                if (track) {
+                    next[index] = -1;
+                }
+                row_valid |= (uint64_t)1 << index;
+                if (heatmap[index] > row_best) {
+                    row_best = heatmap[index];
+                }
+                continue;
+            }
+
+            int from       = (index == 0) ? 0 : index + 1;
+            int best_index = -1;
+            int best_score = NONE;
+            int best_tail  = 0;
+
+            if (q_index == query_len - 2) {
+                // Every position of the last char is a candidate, in order.
+                int adjacent = index + 1;
+
+                if (from < adjacent && (valid & 1)) {
+                    best_index = from;
+                    best_score = below[from].score;
+                }
+
+                if (adjacent < SHORT_MAX && ((valid >> adjacent) & 1) &&
+                    below[adjacent].score + 60 > best_score) {
+                    best_index = adjacent;
+                    best_score = below[adjacent].score + 60;
+                    best_tail  = 1;
+                }
+
+                uint64_t rest = bits_from(valid, adjacent + 1);
+
+                if (rest != 0 && below[best[lowest_bit64(rest)]].score > best_score) {
+                    best_index = best[lowest_bit64(rest)];
+                    best_score = below[best_index].score;
+                    best_tail  = 0;
+                }
+            } else {
+                // Only the best match of the rest of the query is a candidate.
+                uint64_t rest = bits_from(valid, from);
+
+                if (rest != 0) {
+                    best_index = best[lowest_bit64(rest)];
+                    best_score = below[best_index].score;
+                    int cddr   = below[best_index].tail;
+
+                    if ((best_index - 1) == index) {
+                        best_score += (min(cddr, 3) * 15) + // boost contiguous matches
+                                      60;
+                        best_tail = cddr + 1;
+                    }
+                }
+            }
+
+            if (best_index == -1) {
+                continue;
+            }
+
+            cell[index].score = best_score + heatmap[index];
+            cell[index].tail  = best_tail;
+            if (track) {
+                next[index] = best_index;
+            }
+
+            row_valid |= (uint64_t)1 << index;
+            if (cell[index].score > row_best) {
+                row_best = cell[index].score;
+            }
+        }
+
+        if (row_best == NONE || (reach != NULL && row_best + reach[q_index] <= floor)) {
+            return false;
+        }
+
+        valid = row_valid;
+    }
+
+    // Pick the start of the match, from the first row.
+    const match_cell* first = rows[0];
+    int               start = -1;
+
+    for (uint64_t bits = valid; bits != 0; bits &= bits - 1) {
+        int index = lowest_bit64(bits);
+
+        // With a single char, every position is a full match; take the first.
+        if (start == -1 || (query_len > 1 && first[index].score > first[start].score)) {
+            start = index;
+        }
+    }
+
+    out->score = first[start].score;
+    out->tail  = first[start].tail;
+    out->len   = query_len;
+
+    int index = start;
+    for (int q_index = 0; track && q_index < query_len && q_index < out->capacity; ++q_index) {
+        out->indices[q_index] = index;
+        index                 = nexts[q_index * SHORT_MAX + index];
+    }
+
+    return true;
+}
+
+/**
+ * Match CAND against QUERY into OUT, with scratch memory from ARENA.  Unless
+ * MASKS is NULL, CAND is short and MASKS holds the positions of each query
+ * char, for the bit-parallel search; CAND then needs no char index.
+ * Return false if there is no match scoring above THRESHOLD.
+ */
+static bool match_search(flx_arena* arena, const flx_candidate* cand, const uint64_t* masks,
+                         const flx_query* query, int threshold, flx_result_buf* out) {
+    if (cand->len == 0 || query->len == 0) {
+        return false;
+    }
+
+    // The search yields one index per query char.
+    const bool boost = query->full_match_boost && query->len == cand->len;
+
+    int* reach = NULL;
+    int  floor = threshold;
+
+    // Not worth a search if even a perfect match would not make the cut.
+    if (threshold != NONE) {
+        int  bound;
+        bool possible;
+
+        reach = arena_array(arena, int, query->len);
+
+        possible = masks ? short_bound(cand->heatmap, cand->len, masks, query, reach, &bound)
+                         : score_bound(cand, query, reach, &bound);
+
+        if (!possible || bound <= threshold) {
+            return false;
+        }
+
+        floor -= boost ? 10000 : 0;
+    }
+
+    bool found = masks ? find_best_match_short(arena, out, cand->heatmap, masks, query, reach,
+                                               floor)
+                       : find_best_match(arena, out, cand, query, reach, floor);
+
+    if (!found) {
+        return false;
+    }
+
+    if (boost) {
+        out->score += 10000;
+    }
+
+    return out->score > threshold;
+}
+
+/**
+ * Match the prepared CAND against QUERY into OUT, with scratch memory from
+ * ARENA.  Return false if there is no match scoring above THRESHOLD; pass
+ * NONE to accept any match.
+ */
+static bool match_candidate(flx_arena* arena, const flx_candidate* cand, const flx_query* query,
+                            int threshold, flx_result_buf* out) {
+    if (cand->len <= SHORT_MAX && query->len <= SHORT_MAX) {
+        uint64_t masks[SHORT_MAX];
+
+        short_masks_candidate(cand, query, masks);
+        return match_search(arena, cand, masks, query, threshold, out);
+    }
+
+    return match_search(arena, cand, NULL, query, threshold, out);
+}
+
+/**
+ * Same as `score_str` for a non-empty STR known to hold QUERY as a
+ * subsequence.
+ */
+static bool score_subsequence(flx_arena* arena, path_cache* cache, const char* str, int str_len,
+                              const flx_query* query, int threshold, flx_result_buf* out) {
+    flx_candidate cand = {0};
+
+    cand.len     = str_len;
+    cand.heatmap = (query->separator != NIL)
+                           ? get_heatmap_path(arena, cache, str, cand.len, query->separator)
+                           : get_heatmap_str(arena, str, cand.len, NIL);
+
+    // Short strings are searched bit-parallel, straight from the string.
+    if (str_len <= SHORT_MAX && query->len <= SHORT_MAX) {
+        uint64_t masks[SHORT_MAX];
+
+        short_masks(str, str_len, query, masks);
+        return match_search(arena, &cand, masks, query, threshold, out);
+    }
+
+    get_hash_for_string(arena, &cand, str);
+
+    return match_search(arena, &cand, NULL, query, threshold, out);
+}
+
+/**
+ * Score the STR_LEN chars of STR against QUERY into OUT, with scratch memory
+ * from ARENA; STR need not be NUL-terminated.  Paths share directory heatmaps
+ * through CACHE unless it is NULL.
+ * Return false if there is no match scoring above THRESHOLD.
+ */
+static bool score_str(flx_arena* arena, path_cache* cache, const char* str, int str_len,
+                      const flx_query* query, int threshold, flx_result_buf* out) {
+    if (str_len == 0 || query->len == 0) {
+        return false;
+    }
+
+    // Most strings do not match; reject them before any real work.
+    if (!is_subsequence(str, str_len, query)) {
+        return false;
+    }
+
+    return score_subsequence(arena, cache, str, str_len, query, threshold, out);
+}
+
+/**
+ * Copy CAND out of its arena into a single allocation.
+ */
+static flx_candidate* pack_candidate(const flx_candidate* cand) {
+    const int    positions_len = cand->offsets[cand->keys_len];
+    const size_t heatmap_size  = sizeof(int) * cand->len;
+    const size_t offsets_size  = sizeof(int) * (cand->keys_len + 1);
+    const size_t position_size = sizeof(int) * positions_len;
+
+    flx_candidate* packed = malloc(sizeof(*packed) + heatmap_size + offsets_size + position_size);
+
+    *packed           = *cand;
+    packed->heatmap   = (int*)(packed + 1);
+    packed->offsets   = packed->heatmap + cand->len;
+    packed->positions = packed->offsets + cand->keys_len + 1;
+
+    memcpy(packed->heatmap, cand->heatmap, heatmap_size);
+    memcpy(packed->offsets, cand->offsets, offsets_size);
+    memcpy(packed->positions, cand->positions, position_size);
+
+    return packed;
+}
+
+/**
+ * Prepare the LEN chars of STR, whose groups are split by SEPARATOR unless it
+ * is NIL.
+ */
+static flx_candidate* new_candidate(const char* str, size_t len, char separator) {
+    flx_candidate cand = {0};
+
+    cand.len       = (int)len;
+    cand.separator = separator;
+
+    if (cand.len == 0) {
+        flx_candidate* empty = malloc(sizeof(cand));
+        *empty               = cand;
+        return empty;
+    }
+
+    STACK_ARENA(arena);
+
+    get_hash_for_string(&arena, &cand, str);
+    cand.heatmap = get_heatmap_str(&arena, str, cand.len, separator);
+
+    flx_candidate* packed = pack_candidate(&cand);
+
+    arena_release(&arena);
+
+    return packed;
+}
+
+/**
+ * Order matches by score (descending), then by index.
+ */
+static int compare_match(const void* a, const void* b) {
+    const flx_match* lhs = a;
+    const flx_match* rhs = b;
+
+    if (lhs->score != rhs->score) {
+        return (lhs->score < rhs->score) ? 1 : -1;
+    }
+
+    return (lhs->index > rhs->index) - (lhs->index < rhs->index);
+}
+
+/**
+ * Move the match at INDEX up until its parent ranks after it.
+ *
+ * The heap keeps the match that ranks last at the root, so it is the one to
+ * evict when a better match comes along.
+ */
+static void heap_sift_up(flx_match* heap, size_t index) {
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+
+        if (compare_match(&heap[index], &heap[parent]) <= 0) {
+            break;
+        }
+
+        flx_match tmp = heap[index];
+        heap[index]   = heap[parent];
+        heap[parent]  = tmp;
+        index         = parent;
+    }
+}
+
+/**
+ * Move the match at INDEX down until no child of it ranks after it.
+ */
+static void heap_sift_down(flx_match* heap, size_t count, size_t index) {
+    for (;;) {
+        size_t worst = index;
+        size_t left  = 2 * index + 1;
+        size_t right = left + 1;
+
+        if (left < count && compare_match(&heap[left], &heap[worst]) > 0) {
+            worst = left;
+        }
+
+        if (right < count && compare_match(&heap[right], &heap[worst]) > 0) {
+            worst = right;
+        }
+
+        if (worst == index) {
+            return;
+        }
+
+        flx_match tmp = heap[index];
+        heap[index]   = heap[worst];
+        heap[worst]   = tmp;
+        index         = worst;
+    }
+}
+
+/**
+ * Offer MATCH to the HEAP of the best K matches, which holds COUNT of them.
+ */
+static void heap_offer(flx_match* heap, size_t* count, size_t k, flx_match match) {
+    if (*count < k) {
+        heap[*count] = match;
+        heap_sift_up(heap, (*count)++);
+        return;
+    }
+
+    if (compare_match(&match, &heap[0]) >= 0) {
+        return;
+    }
+
+    heap[0] = match;
+    heap_sift_down(heap, k, 0);
+}
+
+/**
+ * Return the score a match must beat to enter the HEAP of the best K matches.
+ *
+ * Candidates come in index order, so a later match with the same score as the
+ * root would rank after it.
+ */
+static int heap_threshold(const flx_match* heap, size_t count, size_t k) {
+    return (count < k) ? NONE : heap[0].score;
+}
+
+#if defined(__AVX2__)
+#define BATCH_LANES 16
+
+typedef __m256i lane_vec;
+
+#define lane_set(x)      _mm256_set1_epi16((short)(x))
+#define lane_load(p)     _mm256_loadu_si256((const __m256i*)(p))
+#define lane_store(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+#define lane_add         _mm256_add_epi16
+#define lane_sub         _mm256_sub_epi16
+#define lane_mul         _mm256_mullo_epi16
+#define lane_min         _mm256_min_epi16
+#define lane_max         _mm256_max_epi16
+#define lane_eq          _mm256_cmpeq_epi16
+#define lane_gt          _mm256_cmpgt_epi16
+#define lane_and         _mm256_and_si256
+#define lane_andnot      _mm256_andnot_si256
+#define lane_or          _mm256_or_si256
+#elif defined(FLX_SSE2)
+#define BATCH_LANES 8
+
+typedef __m128i lane_vec;
+
+#define lane_set(x)      _mm_set1_epi16((short)(x))
+#define lane_load(p)     _mm_loadu_si128((const __m128i*)(p))
+#define lane_store(p, v) _mm_storeu_si128((__m128i*)(p), (v))
+#define lane_add         _mm_add_epi16
+#define lane_sub         _mm_sub_epi16
+#define lane_mul         _mm_mullo_epi16
+#define lane_min         _mm_min_epi16
+#define lane_max         _mm_max_epi16
+#define lane_eq          _mm_cmpeq_epi16
+#define lane_gt          _mm_cmpgt_epi16
+#define lane_and         _mm_and_si128
+#define lane_andnot      _mm_andnot_si128
+#define lane_or          _mm_or_si128
+#endif
+
+#if defined(BATCH_LANES)
+/**
+ * Short strings scored together, one per SIMD lane.
+ *
+ * Each array holds a row per position and a lane per string, so a row loads
+ * as one vector.  Scores are 16-bit: over SHORT_MAX chars and query chars a
+ * heat stays within a few hundred and a match within 16 bits.
+ */
+typedef struct score_batch {
+    int16_t text[SHORT_MAX][BATCH_LANES];  // chars
+    int16_t down[SHORT_MAX][BATCH_LANES];  // chars with capitals lowercased
+    int16_t words[SHORT_MAX][BATCH_LANES]; // -1 for a word char, else 0
+    int16_t caps[SHORT_MAX][BATCH_LANES];  // -1 for a capital, else 0
+    int16_t heat[SHORT_MAX][BATCH_LANES];
+
+    // Rolling rows of the search: score, contiguous tail, and -1 where the
+    // rest of the query matches from the position.
+    int16_t score[2][SHORT_MAX][BATCH_LANES];
+    int16_t tail[2][SHORT_MAX][BATCH_LANES];
+    int16_t valid[2][SHORT_MAX][BATCH_LANES];
+
+    int16_t lens[BATCH_LANES];
+    size_t  indices[BATCH_LANES];
+    int     count; // strings in the batch
+    int     len;   // longest of them
+
+    // Per char: lowercased, then word char and capital as -1 or 0.
+    int16_t down_of[256];
+    int16_t word_of[256];
+    int16_t cap_of[256];
+    bool    usable; // whether the query can be batched
+} score_batch;
+
+/**
+ * Return the lanes of A where MASK is set and of B elsewhere.
+ */
+static lane_vec lane_select(lane_vec mask, lane_vec a, lane_vec b) {
+    return lane_or(lane_and(mask, a), lane_andnot(mask, b));
+}
+
+/**
+ * Prepare an empty BATCH for QUERY.
+ */
+static void batch_init(score_batch* batch, const flx_query* query) {
+    memset(batch, 0, sizeof(*batch));
+
+    // Path heatmaps come from the directory cache; only plain strings batch.
+    batch->usable = (query->separator == NIL && query->len <= SHORT_MAX);
+
+    if (!batch->usable) {
+        return;
+    }
+
+    for (int c = 0; c < 256; ++c) {
+        char ch = (char)c;
+
+        batch->down_of[c] = (unsigned char)(capital(ch) ? tolower(ch) : ch);
+        batch->word_of[c] = word(ch) ? -1 : 0;
+        batch->cap_of[c]  = capital(ch) ? -1 : 0;
+    }
+}
+
+/**
+ * Take the STR_LEN chars of STR, candidate INDEX, into BATCH to be scored
+ * against QUERY with the rest of it.  Strings that cannot match are dropped
+ * here.  Return false if STR does not fit the batch; score it alone.
+ */
+static bool batch_take(score_batch* batch, const flx_query* query, size_t index, const char* str,
+                       int str_len) {
+    if (!batch->usable || str_len == 0 || str_len > SHORT_MAX) {
+        return false;
+    }
+
+    if (!is_subsequence(str, str_len, query)) {
+        return true;
+    }
+
+    int lane = batch->count++;
+
+    for (int i = 0; i < str_len; ++i) {
+        unsigned char ch = (unsigned char)str[i];
+
+        batch->text[i][lane]  = ch;
+        batch->down[i][lane]  = batch->down_of[ch];
+        batch->words[i][lane] = batch->word_of[ch];
+        batch->caps[i][lane]  = batch->cap_of[ch];
+    }
+
+    batch->lens[lane]    = (int16_t)str_len;
+    batch->indices[lane] = index;
+    batch->len           = (str_len > batch->len) ? str_len : batch->len;
+
+    return true;
+}
+
+/**
+ * Fill the heatmaps of BATCH, as `get_heatmap_str` without a group separator
+ * would, and store in WORD_COUNTS the number of words of each string.
+ *
+ * With a single group every position takes the same basepath boost, which
+ * depends on the word count only known at the end; the caller adds it.
+ */
+static void batch_heatmaps(score_batch* batch, int16_t* word_counts) {
+    const lane_vec lens = lane_load(batch->lens);
+    const lane_vec zero = lane_set(0);
+
+    lane_vec seen      = zero; // a word char came before
+    lane_vec prev_word = zero;
+    lane_vec prev_cap  = zero;
+    lane_vec prev_dot  = zero;
+    lane_vec prev_nul  = zero;
+    lane_vec word_idx  = lane_set(-1);
+    lane_vec word_beg  = zero;
+    lane_vec count     = zero;
+
+    for (int i = 0; i < batch->len; ++i) {
+        lane_vec text = lane_load(batch->text[i]);
+        lane_vec wch  = lane_load(batch->words[i]);
+        lane_vec cap  = lane_load(batch->caps[i]);
+        lane_vec pos  = lane_set(i);
+
+        // Before any word, every char starts one; see `get_heatmap_str`.
+        lane_vec start = lane_or(lane_andnot(seen, lane_set(-1)),
+                                 lane_or(prev_nul, lane_or(lane_andnot(prev_cap, cap),
+                                                           lane_andnot(prev_word, wch))));
+
+        word_idx = lane_sub(word_idx, start);
+        word_beg = lane_select(start, pos, word_beg);
+
+        lane_vec heat = lane_set(default_score);
+        heat          = lane_add(heat, lane_and(prev_dot, lane_set(-45)));
+        heat          = lane_add(heat, lane_and(start, lane_set(85)));
+        heat          = lane_sub(heat, lane_mul(word_idx, lane_set(3)));
+        heat          = lane_sub(heat, lane_sub(pos, word_beg));
+        heat          = lane_sub(heat, lane_eq(lens, lane_set(i + 1)));
+        lane_store(batch->heat[i], heat);
+
+        lane_vec inside = lane_gt(lens, pos);
+
+        count = lane_sub(count, lane_and(inside, lane_andnot(prev_word, wch)));
+
+        seen      = lane_or(seen, wch);
+        prev_word = wch;
+        prev_cap  = cap;
+        prev_dot  = lane_eq(text, lane_set('.'));
+        prev_nul  = lane_eq(text, zero);
+    }
+
+    lane_store(word_counts, count);
+}
+
+/**
+ * Return the lanes of BATCH whose char at POS matches the query char QCH.
+ */
+static lane_vec batch_match(const score_batch* batch, int pos, lane_vec qch) {
+    lane_vec hit = lane_or(lane_eq(lane_load(batch->text[pos]), qch),
+                           lane_eq(lane_load(batch->down[pos]), qch));
+
+    return lane_and(hit, lane_gt(lane_load(batch->lens), lane_set(pos)));
+}
+
+/**
+ * Run the search of `find_best_match` on every string of BATCH against
+ * QUERY at once, and store the best score of each in SCORES, or NONE.
+ *
+ * The table is dense: a row visits every position, and a lane whose char does
+ * not match is masked off.  Walking a row backwards, the best match of the
+ * rest of the query from the next position, and from the one after, rides
+ * along in registers.
+ */
+static void batch_search(score_batch* batch, const flx_query* query, int* scores) {
+    const int      query_len = query->len;
+    const int      len       = batch->len;
+    const lane_vec zero      = lane_set(0);
+
+    int16_t word_counts[BATCH_LANES];
+
+    batch_heatmaps(batch, word_counts);
+
+    for (int q_index = query_len - 1; q_index >= 0; --q_index) {
+        const lane_vec qch   = lane_set((unsigned char)query->str[q_index]);
+        int16_t(*score)[BATCH_LANES] = batch->score[q_index & 1];
+        int16_t(*tail)[BATCH_LANES]  = batch->tail[q_index & 1];
+        int16_t(*valid)[BATCH_LANES] = batch->valid[q_index & 1];
+
+        if (q_index == query_len - 1) {
+            for (int i = 0; i < len; ++i) {
+                lane_store(score[i], lane_load(batch->heat[i]));
+                lane_store(tail[i], zero);
+                lane_store(valid[i], batch_match(batch, i, qch));
+            }
+            continue;
+        }
+
+        int16_t(*below_score)[BATCH_LANES] = batch->score[(q_index + 1) & 1];
+        int16_t(*below_tail)[BATCH_LANES]  = batch->tail[(q_index + 1) & 1];
+        int16_t(*below_valid)[BATCH_LANES] = batch->valid[(q_index + 1) & 1];
+
+        // The best match below from I + 1 on and from I + 2 on; PICK is set
+        // where the former is the one at I + 1 itself.  NEXT is the cell
+        // below at I + 1.
+        lane_vec best_score = zero, best_tail = zero, best_valid = zero, pick = zero;
+        lane_vec rest_score = zero, rest_valid = zero;
+        lane_vec next_score = zero, next_valid = zero;
+
+        for (int i = len - 1; i >= 0; --i) {
+            lane_vec here_score = lane_load(below_score[i]);
+            lane_vec here_tail  = lane_load(below_tail[i]);
+            lane_vec here_valid = lane_load(below_valid[i]);
+
+            // Ties go to the first position.
+            lane_vec take = lane_andnot(lane_and(best_valid, lane_gt(best_score, here_score)),
+                                        here_valid);
+
+            lane_vec cell_score, cell_tail, cell_valid;
+
+            if (q_index == query_len - 2) {
+                // Every position of the last char is a candidate, in order.
+                cell_score = zero;
+                cell_tail  = zero;
+                cell_valid = zero;
+
+                if (i == 0) {
+                    cell_score = here_score;
+                    cell_valid = here_valid;
+                }
+
+                lane_vec adjacent = lane_add(next_score, lane_set(60));
+                lane_vec better   = lane_or(lane_andnot(cell_valid, next_valid),
+                                            lane_and(next_valid, lane_gt(adjacent, cell_score)));
+                cell_score        = lane_select(better, adjacent, cell_score);
+                cell_tail         = lane_select(better, lane_set(1), cell_tail);
+                cell_valid        = lane_or(cell_valid, next_valid);
+
+                better     = lane_or(lane_andnot(cell_valid, rest_valid),
+                                     lane_and(rest_valid, lane_gt(rest_score, cell_score)));
+                cell_score = lane_select(better, rest_score, cell_score);
+                cell_tail  = lane_select(better, zero, cell_tail);
+                cell_valid = lane_or(cell_valid, rest_valid);
+            } else {
+                // Only the best match of the rest of the query is a candidate;
+                // at position 0 it may be position 0 itself.
+                lane_vec from_score = best_score, from_tail = best_tail;
+                lane_vec from_valid = best_valid, adjacent = pick;
+
+                if (i == 0) {
+                    from_score = lane_select(take, here_score, best_score);
+                    from_tail  = lane_select(take, here_tail, best_tail);
+                    from_valid = lane_or(here_valid, best_valid);
+                    adjacent   = lane_andnot(take, pick);
+                }
+
+                lane_vec boost = lane_add(lane_mul(lane_min(from_tail, lane_set(3)), lane_set(15)),
+                                          lane_set(60)); // boost contiguous matches
+
+                cell_score = lane_add(from_score, lane_and(adjacent, boost));
+                cell_tail  = lane_and(adjacent, lane_add(from_tail, lane_set(1)));
+                cell_valid = from_valid;
+            }
+
+            lane_store(score[i], lane_add(cell_score, lane_load(batch->heat[i])));
+            lane_store(tail[i], cell_tail);
+            lane_store(valid[i], lane_and(cell_valid, batch_match(batch, i, qch)));
+
+            rest_score = best_score;
+            rest_valid = best_valid;
+            best_score = lane_select(take, here_score, best_score);
+            best_tail  = lane_select(take, here_tail, best_tail);
+            best_valid = lane_or(here_valid, best_valid);
+            pick       = take;
+            next_score = here_score;
+            next_valid = here_valid;
+        }
+    }
+
+    // The best start of the first row; with a single char, every position is
+    // a full match and the first one counts.
+    lane_vec found = zero;
+    lane_vec best  = lane_set(INT16_MIN);
+
+    for (int i = len - 1; i >= 0; --i) {
+        lane_vec here  = lane_load(batch->score[0][i]);
+        lane_vec valid = lane_load(batch->valid[0][i]);
+
+        best  = lane_select(valid, (query_len > 1) ? lane_max(best, here) : here, best);
+        found = lane_or(found, valid);
+    }
+
+    int16_t bests[BATCH_LANES];
+    int16_t founds[BATCH_LANES];
+
+    lane_store(bests, best);
+    lane_store(founds, found);
+
+    for (int lane = 0; lane < batch->count; ++lane) {
+        if (!founds[lane]) {
+            scores[lane] = NONE;
+            continue;
+        }
+
+        // ++++ basepath word count penalty, on each of the matched chars
+        int num = 35 - word_counts[lane];
+        num     = (num == 0) ? 1 : num; // as in `get_heatmap_str`
+
+        scores[lane] = bests[lane] + num * query_len;
+
+        if (query->full_match_boost && query_len == batch->lens[lane]) {
+            scores[lane] += 10000;
+        }
+    }
+}
+
+/**
+ * Score the strings of BATCH against QUERY and empty it.  Their matches are
+ * offered to the heap of the best K matches in OUT, which holds COUNT of
+ * them, or appended to OUT if K is 0.
+ */
+static void batch_flush(score_batch* batch, const flx_query* query, flx_match* out, size_t* count,
+                        size_t k) {
+    int scores[BATCH_LANES];
+
+    if (batch->count == 0) {
+        return;
+    }
+
+    // Idle lanes hold an empty string.
+    for (int lane = batch->count; lane < BATCH_LANES; ++lane) {
+        batch->lens[lane] = 0;
+    }
+
+    batch_search(batch, query, scores);
+
+    for (int lane = 0; lane < batch->count; ++lane) {
+        if (scores[lane] == NONE) {
+            continue;
+        }
+
+        flx_match match = {batch->indices[lane], scores[lane]};
+
+        if (k == 0) {
+            out[(*count)++] = match;
+        } else {
+            heap_offer(out, count, k, match);
+        }
+    }
+
+    batch->count = 0;
+    batch->len   = 0;
+}
+#endif
+
+/**
+ * Return line INDEX of CORPUS and store its length in LEN; not NUL-terminated.
+ */
+static const char* corpus_line(const flx_corpus* corpus, size_t index, size_t* len) {
+    const char* line = corpus->data + corpus->starts[index];
+
+    *len = corpus->starts[index + 1] - corpus->starts[index] - 1;
+
+    // Tolerate CRLF input.
+    if (*len > 0 && line[*len - 1] == '\r') {
+        --*len;
+    }
+
+    return line;
+}
+
+/**
+ * Score line INDEX of CORPUS in place, as `score_str` does.
+ */
+static bool corpus_score(flx_arena* arena, path_cache* cache, const flx_corpus* corpus,
+                         size_t index, const flx_query* query, int threshold,
+                         flx_result_buf* out) {
+    size_t      len;
+    const char* line = corpus_line(corpus, index, &len);
+
+    return score_str(arena, cache, line, (int)len, query, threshold, out);
+}
+
+/**
+ * Record in CORPUS where each line of its mapped data starts.
+ */
+static void corpus_index(flx_corpus* corpus) {
+    const char* data = corpus->data;
+    size_t      pos  = 0;
+    const char* eol;
+
+    while (pos < corpus->size && (eol = memchr(data + pos, '\n', corpus->size - pos)) != NULL) {
+        arrput(corpus->starts, pos);
+        pos = eol - data + 1;
+    }
+
+    // The last line may lack its newline; pretend it has one.
+    if (pos < corpus->size) {
+        arrput(corpus->starts, pos);
+        pos = corpus->size + 1;
+    }
+
+    corpus->count = arrlen(corpus->starts);
+    arrput(corpus->starts, pos);
+}
+
+/**
+ * Return the char-presence mask of the chars of STR from BEG to END.
+ */
+static uint64_t chars_mask(const char* str, int beg, int end) {
+    uint64_t mask = 0;
+
+    for (int i = beg; i < end; ++i) {
+        mask |= char_bit(str[i]);
+    }
+
+    return mask;
+}
+
+/**
+ * Order trie entries by path.
+ */
+static int compare_entry(const void* a, const void* b) {
+    const trie_entry* lhs = a;
+    const trie_entry* rhs = b;
+
+    int cmp = memcmp(lhs->str, rhs->str, min(lhs->len, rhs->len));
+
+    return (cmp != 0) ? cmp : (lhs->len > rhs->len) - (lhs->len < rhs->len);
+}
+
+/**
+ * Add the node of the sorted entries from BEGIN to END of TRIE, which share
+ * their first START chars, and return its index.
+ *
+ * Paths under a common prefix are contiguous once sorted, so each
+ * subdirectory is a sub-range, and the common prefix of a range is that of
+ * its first and last path.
+ */
+static int trie_build(flx_trie* trie, size_t begin, size_t end, int start) {
+    const trie_entry* first = &trie->entries[begin];
+    const trie_entry* last  = &trie->entries[end - 1];
+
+    int label_end = start;
+
+    while (label_end < first->len && label_end < last->len &&
+           first->str[label_end] == last->str[label_end]) {
+        ++label_end;
+    }
+
+    // Cut the label after the last separator it holds.
+    while (label_end > start && first->str[label_end - 1] != '/') {
+        --label_end;
+    }
+
+    trie_node node = {begin, end, start, label_end, 0, -1, -1};
+    int       id   = arrlen(trie->nodes);
+    int       prev = -1;
+
+    node.mask = chars_mask(first->str, start, label_end);
+    arrput(trie->nodes, node);
+
+    for (size_t i = begin; i < end;) {
+        const trie_entry* entry = &trie->entries[i];
+        const char*       slash = memchr(entry->str + label_end, '/', entry->len - label_end);
+
+        if (slash == NULL) {
+            trie->nodes[id].mask |= chars_mask(entry->str, label_end, entry->len);
+            ++i;
+            continue;
+        }
+
+        int    dir_end = slash - entry->str + 1;
+        size_t j       = i + 1;
+
+        while (j < end && trie->entries[j].len >= dir_end &&
+               memcmp(trie->entries[j].str + label_end, entry->str + label_end,
+                      dir_end - label_end) == 0) {
+            ++j;
+        }
+
+        int child = trie_build(trie, i, j, label_end);
+
+        if (prev == -1) {
+            trie->nodes[id].first_child = child;
+        } else {
+            trie->nodes[prev].next_sibling = child;
+        }
+
+        trie->nodes[id].mask |= trie->nodes[child].mask;
+        prev = child;
+        i    = j;
+    }
+
+    return id;
+}
+
+/**
+ * @struct Top-K search of a trie.
+ */
+typedef struct {
+    const flx_trie*  trie;
+    const flx_query* query;
+    const uint64_t*  rest;  /* Char-presence mask of the query chars from each index on */
+    flx_arena*       arena;
+    path_cache*      cache;
+    flx_match*       heap;
+    size_t           count;
+    size_t           k;
+} trie_search;
+
+/**
+ * Score ENTRY of SEARCH, whose first FROM chars matched the query up to
+ * Q_INDEX.
+ */
+static void trie_score(trie_search* search, const trie_entry* entry, int from, int q_index) {
+    const flx_query* query = search->query;
+
+    if (entry->len == 0) {
+        return;
+    }
+
+    if (advance_query(entry->str, from, entry->len, query, q_index) < query->len) {
+        return;
+    }
+
+    flx_result_buf result    = {0};
+    int            threshold = heap_threshold(search->heap, search->count, search->k);
+
+    // Paths are not scored in index order, so a match tying with the root
+    // may still rank before it.
+    if (threshold != NONE) {
+        --threshold;
+    }
+
+    flx_arena_reset(search->arena);
+
+    if (score_subsequence(search->arena, search->cache, entry->str, entry->len, query, threshold,
+                          &result)) {
+        heap_offer(search->heap, &search->count, search->k,
+                   (flx_match){entry->index, result.score});
+    }
+}
+
+/**
+ * Score the paths under node ID of SEARCH, whose parent matched the query up
+ * to Q_INDEX.  Skip them all when the query chars left do not all occur below.
+ */
+static void trie_visit(trie_search* search, int id, int q_index) {
+    const trie_node*  node    = &search->trie->nodes[id];
+    const trie_entry* entries = search->trie->entries;
+
+    if ((search->rest[q_index] & ~node->mask) != 0) {
+        return;
+    }
+
+    q_index = advance_query(entries[node->begin].str, node->label_start, node->label_end,
+                            search->query, q_index);
+
+    size_t i = node->begin;
+
+    for (int child = node->first_child;; child = search->trie->nodes[child].next_sibling) {
+        size_t stop = (child == -1) ? node->end : search->trie->nodes[child].begin;
+
+        for (; i < stop; ++i) {
+            trie_score(search, &entries[i], node->label_end, q_index);
+        }
+
+        if (child == -1) {
+            break;
+        }
+
+        trie_visit(search, child, q_index);
+        i = search->trie->nodes[child].end;
+    }
+}
+
+/**
+ * Sort the entries of TRIE and build its nodes.
+ */
+static flx_trie* trie_finish(flx_trie* trie) {
+    size_t n = arrlen(trie->entries);
+
+    if (n > 0) {
+        qsort(trie->entries, n, sizeof(*trie->entries), compare_entry);
+        trie_build(trie, 0, n, 0);
+    }
+
+    return trie;
+}
+
+/**
+ * @struct Chunks of candidates handed to one worker; any worker may claim them.
+ */
+typedef struct {
+    size_t next; /* Next chunk to claim */
+    size_t end;  /* One past the last chunk */
+} pool_slot;
+
+/**
+ * @struct Parallel ranking shared by all workers.
+ */
+typedef struct {
+    const char**          strs;   /* Strings to test, or NULL */
+    const flx_candidate** cands;  /* Prepared strings to test, or NULL */
+    const flx_corpus*     corpus; /* Lines to test, or NULL */
+    size_t                n;
+    const flx_query*      query;
+    size_t                k;
+    pool_slot*            slots; /* One per worker */
+    int                   workers;
+} flx_pool;
+
+/**
+ * @struct A worker of the parallel ranking and its best K matches.
+ */
+typedef struct {
+    flx_pool*  pool;
+    int        id;
+    flx_match* heap;
+    size_t     count;
+} pool_worker;
+
+/**
+ * Claim the next chunk of SLOT; it is past SLOT->end once the slot is empty.
+ */
+static size_t pool_claim(pool_slot* slot) {
+#if defined(_WIN64)
+    return (size_t)InterlockedExchangeAdd64((volatile LONG64*)&slot->next, 1);
+#elif defined(_WIN32)
+    return (size_t)InterlockedExchangeAdd((volatile LONG*)&slot->next, 1);
+#else
+    return __atomic_fetch_add(&slot->next, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+/**
+ * Score the candidates of WORKER's own slot, then steal the chunks left in
+ * the slots of the others.
+ */
+static void pool_work(pool_worker* worker) {
+    flx_pool* pool = worker->pool;
+
+    STACK_ARENA(arena);
+
+    path_cache cache = {0};
+
+    for (int victim = 0; victim < pool->workers; ++victim) {
+        pool_slot* slot = &pool->slots[(worker->id + victim) % pool->workers];
+
+        for (size_t chunk = pool_claim(slot); chunk < slot->end; chunk = pool_claim(slot)) {
+            size_t end = min((chunk + 1) * POOL_CHUNK_SIZE, pool->n);
+
+            for (size_t i = chunk * POOL_CHUNK_SIZE; i < end; ++i) {
+                flx_result_buf result    = {0};
+                int            threshold = heap_threshold(worker->heap, worker->count, pool->k);
+
+                // Chunks are not scored in index order, so a match tying
+                // with the root may still rank before it.
+                if (threshold != NONE) {
+                    --threshold;
+                }
+
+                flx_arena_reset(&arena);
+
+                bool found;
+
+                if (pool->cands) {
+                    found = can_match(pool->cands[i], pool->query) &&
+                            match_candidate(&arena, pool->cands[i], pool->query, threshold,
+                                            &result);
+                } else if (pool->corpus) {
+                    found = corpus_score(&arena, &cache, pool->corpus, i, pool->query, threshold,
+                                         &result);
+                } else {
+                    found = score_str(&arena, &cache, pool->strs[i], strlen(pool->strs[i]),
+                                      pool->query, threshold, &result);
+                }
+
+                if (found) {
+                    heap_offer(worker->heap, &worker->count, pool->k,
+                               (flx_match){i, result.score});
+                }
+            }
+        }
+    }
+
+    path_cache_release(&cache);
+    arena_release(&arena);
+}
+
+#if defined(_WIN32)
+typedef HANDLE pool_thread;
+
+static DWORD WINAPI pool_main(LPVOID arg) {
+    pool_work(arg);
+    return 0;
+}
+
+static bool pool_spawn(pool_thread* thread, pool_worker* worker) {
+    *thread = CreateThread(NULL, 0, pool_main, worker, 0, NULL);
+    return *thread != NULL;
+}
+
+static void pool_join(pool_thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+typedef pthread_t pool_thread;
+
+static void* pool_main(void* arg) {
+    pool_work(arg);
+    return NULL;
+}
+
+static bool pool_spawn(pool_thread* thread, pool_worker* worker) {
+    return pthread_create(thread, NULL, pool_main, worker) == 0;
+}
+
+static void pool_join(pool_thread thread) { pthread_join(thread, NULL); }
+#endif
+
+/**
+ * Return the number of processors online.
+ */
+static int cpu_count(void) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (int)count : 1;
+#endif
+}
+
+/**
+ * Rank the candidates of POOL on THREADS workers into OUT.
+ *
+ * The caller's thread is worker 0.  A worker that fails to start costs
+ * nothing but speed, since the others steal its chunks.
+ */
+static size_t pool_run(flx_pool* pool, int threads, flx_match* out) {
+    size_t chunks = (pool->n + POOL_CHUNK_SIZE - 1) / POOL_CHUNK_SIZE;
+
+    if (threads <= 0) {
+        threads = cpu_count();
+    }
+
+    pool->workers = (int)min((size_t)threads, chunks);
+
+    if (pool->workers == 0) {
+        return 0;
+    }
+
+    pool->slots = malloc(sizeof(pool_slot) * pool->workers);
+
+    pool_worker* workers = malloc(sizeof(pool_worker) * pool->workers);
+    pool_thread* handles = malloc(sizeof(pool_thread) * pool->workers);
+    bool*        started = malloc(sizeof(bool) * pool->workers);
+    flx_match*   heaps   = malloc(sizeof(flx_match) * pool->k * pool->workers);
+
+    for (int i = 0; i < pool->workers; ++i) {
+        pool->slots[i].next = chunks * i / pool->workers;
+        pool->slots[i].end  = chunks * (i + 1) / pool->workers;
+
+        workers[i].pool  = pool;
+        workers[i].id    = i;
+        workers[i].heap  = heaps + pool->k * i;
+        workers[i].count = 0;
+    }
+
+    for (int i = 1; i < pool->workers; ++i) {
+        started[i] = pool_spawn(&handles[i], &workers[i]);
+    }
+
+    pool_work(&workers[0]);
+
+    size_t count = 0;
+
+    for (int i = 0; i < pool->workers; ++i) {
+        if (i > 0 && started[i]) {
+            pool_join(handles[i]);
+        }
+
+        for (size_t j = 0; j < workers[i].count; ++j) {
+            heap_offer(out, &count, pool->k, workers[i].heap[j]);
+        }
+    }
+
+    free(heaps);
+    free(started);
+    free(handles);
+    free(workers);
+    free(pool->slots);
+
+    qsort(out, count, sizeof(*out), compare_match);
+
+    return count;
+}
+
+/**
+ * Score LINE, which is NUL-terminated in place, as the next line of STREAM.
+ */
+static void stream_score_line(flx_stream* stream, char* line, size_t len) {
+    size_t number = stream->lines++;
+
+    if (stream->k == 0) {
+        return;
+    }
+
+    // Tolerate CRLF input.
+    if (len > 0 && line[len - 1] == '\r') {
+        line[--len] = '\0';
+    }
+
+    STACK_ARENA(arena);
+
+    // Lines come in order, so a match that passes the threshold evicts the
+    // root of a full heap.
+    flx_result_buf result    = {0};
+    int            threshold = heap_threshold(stream->heap, stream->count, stream->k);
+
+    if (score_str(&arena, &stream->cache, line, len, stream->query, threshold, &result)) {
+        if (stream->count == stream->k) {
+            size_t evicted = stream->heap[0].index;
+            free(hmget(stream->texts, evicted));
+            (void)hmdel(stream->texts, evicted);
+        }
+
+        heap_offer(stream->heap, &stream->count, stream->k, (flx_match){number, result.score});
+
+        char* text = malloc(len + 1);
+        memcpy(text, line, len + 1);
+        hmput(stream->texts, number, text);
+    }
+
+    arena_release(&arena);
+}
+
+/**
+ * Score every complete line in the buffer of STREAM, and the rest too if
+ * FLUSH is set; keep the unfinished line for the next read.
+ */
+static void stream_drain(flx_stream* stream, bool flush) {
+    char*  line = stream->buf;
+    size_t left = stream->len;
+    char*  eol;
+
+    while ((eol = memchr(line, '\n', left)) != NULL) {
+        size_t len = eol - line;
+
+        *eol = '\0';
+        stream_score_line(stream, line, len);
+
+        line += len + 1;
+        left -= len + 1;
+    }
+
+    if (flush && left > 0) {
+        line[left] = '\0';
+        stream_score_line(stream, line, left);
+        left = 0;
+    }
+
+    memmove(stream->buf, line, left);
+    stream->len = left;
+}
+
+/**
+ * Compile QUERY for repeated scoring.
+ * @param *query Query use to score.
+ * @return The compiled query; free it with `flx_query_free`.
+ */
+flx_query* flx_query_compile(const char* query) {
+    return flx_query_compile_n(query, strlen(query));
+}
+
+/**
+ * Same as `flx_query_compile` with the LEN chars of QUERY.
+ * @param *query Query use to score; need not be NUL-terminated.
+ * @param len Length of QUERY.
+ * @return The compiled query; free it with `flx_query_free`.
+ */
+flx_query* flx_query_compile_n(const char* query, size_t len) {
+    // The query chars are stored right after the struct.
+    flx_query* q   = malloc(sizeof(*q) + len + 1);
+    char*      str = (char*)(q + 1);
+    memcpy(str, query, len);
+    str[len] = '\0';
+
+    init_query(q, str, len);
+    return q;
+}
+
+/**
+ * Compile QUERY for scoring '/'-separated paths.
+ * @param *query Query use to score.
+ * @return The compiled query; free it with `flx_query_free`.
+ */
+flx_query* flx_query_compile_path(const char* query) {
+    return flx_query_compile_path_n(query, strlen(query));
+}
+
+/**
+ * Same as `flx_query_compile_path` with the LEN chars of QUERY.
+ * @param *query Query use to score; need not be NUL-terminated.
+ * @param len Length of QUERY.
+ * @return The compiled query; free it with `flx_query_free`.
+ */
+flx_query* flx_query_compile_path_n(const char* query, size_t len) {
+    flx_query* q = flx_query_compile_n(query, len);
+    q->separator = '/';
+    return q;
+}
+
+/**
+ * Free compiled query.
+ * @param *query The compiled query to free.
+ */
+void flx_query_free(flx_query* query) { free(query); }
+
+/**
+ * Create an arena for scratch memory.
+ * @param size Bytes per block; 0 uses the default.
+ * @return The arena; free it with `flx_arena_free`.
+ */
+flx_arena* flx_arena_new(size_t size) {
+    flx_arena* arena  = malloc(1 * sizeof(*arena));
+    arena->head       = NULL;
+    arena->block_size = (size != 0) ? size : ARENA_BLOCK_SIZE;
+    return arena;
+}
+
+/**
+ * Release everything allocated from ARENA and keep its memory for reuse.
+ * @param *arena The arena to reset.
+ */
+void flx_arena_reset(flx_arena* arena) {
+    flx_block* block = arena->head;
+
+    if (!block) {
+        return;
+    }
+
+    if (!block->next) {
+        block->used = 0;
+        return;
+    }
+
+    // The last round spilled over several blocks; merge them into one with
+    // room for twice the whole round, as the next may need a little more.
+    // A block the arena does not own, such as the stack a one-shot call
+    // seeds it with, is dropped from the chain, so the next round stays in
+    // the merged block; only what it served counts, once.
+    size_t total = 0;
+
+    while (block) {
+        flx_block* next = block->next;
+
+        if (block->owned) {
+            total += block->size;
+            free(block);
+        } else {
+            total += block->used;
+        }
+
+        block = next;
+    }
+
+    arena->head = NULL;
+    arena_push_block(arena, total * 2);
+}
+
+/**
+ * Free arena.
+ * @param *arena The arena to free.
+ */
+void flx_arena_free(flx_arena* arena) {
+    if (!arena) {
+        return;
+    }
+
+    arena_release(arena);
+    free(arena);
+}
+
+/**
+ * Prepare STR for repeated scoring.
+ * @param *str String to prepare.
+ * @return The prepared candidate; free it with `flx_candidate_free`.
+ */
+flx_candidate* flx_candidate_new(const char* str) { return flx_candidate_new_n(str, strlen(str)); }
+
+/**
+ * Same as `flx_candidate_new` with the LEN chars of STR.
+ * @param *str String to prepare; need not be NUL-terminated.
+ * @param len Length of STR.
+ * @return The prepared candidate; free it with `flx_candidate_free`.
+ */
+flx_candidate* flx_candidate_new_n(const char* str, size_t len) {
+    return new_candidate(str, len, NIL);
+}
+
+/**
+ * Prepare '/'-separated path STR for repeated scoring.
+ * @param *str Path to prepare.
+ * @return The prepared candidate; free it with `flx_candidate_free`.
+ */
+flx_candidate* flx_candidate_new_path(const char* str) {
+    return flx_candidate_new_path_n(str, strlen(str));
+}
+
+/**
+ * Same as `flx_candidate_new_path` with the LEN chars of STR.
+ * @param *str Path to prepare; need not be NUL-terminated.
+ * @param len Length of STR.
+ * @return The prepared candidate; free it with `flx_candidate_free`.
+ */
+flx_candidate* flx_candidate_new_path_n(const char* str, size_t len) {
+    return new_candidate(str, len, '/');
+}
+
+/**
+ * Free prepared candidate.
+ * @param *candidate The prepared candidate to free.
+ */
+void flx_candidate_free(flx_candidate* candidate) { free(candidate); }
+
+/**
+ * Free result.
+ * @param *result The score result to free.
+ */
+void flx_free(flx_result* result) {
+    if (!result) {
+        return;
+    }
+
+    if (result->indices != NULL) {
+        arrfree(result->indices);
+    }
+
+    free(result);
+}
+
+/**
+ * Return best score matching QUERY against STR.
+ * @param *str String to test.
+ * @param *query Query use to score.
+ */
+flx_result* flx_score(const char* str, const char* query) {
+    return flx_score_n(str, strlen(str), query, strlen(query));
+}
+
+/**
+ * Same as `flx_score` with the LEN chars of STR and the QLEN chars of QUERY.
+ * @param *str String to test; need not be NUL-terminated.
+ * @param len Length of STR.
+ * @param *query Query use to score; need not be NUL-terminated.
+ * @param qlen Length of QUERY.
+ */
+flx_result* flx_score_n(const char* str, size_t len, const char* query, size_t qlen) {
+    flx_query q;
+    init_query(&q, query, qlen);
+    return flx_score_q_n(str, len, &q);
+}
+
+/**
+ * Return best score matching compiled QUERY against STR.
+ * @param *str String to test.
+ * @param *query Compiled query use to score.
+ */
+flx_result* flx_score_q(const char* str, const flx_query* query) {
+    return flx_score_q_n(str, strlen(str), query);
+}
+
+/**
+ * Same as `flx_score_q` with the LEN chars of STR.
+ * @param *str String to test; need not be NUL-terminated.
+ * @param len Length of STR.
+ * @param *query Compiled query use to score.
+ */
+flx_result* flx_score_q_n(const char* str, size_t len, const flx_query* query) {
+    STACK_ARENA(arena);
+
+    flx_result* result = flx_score_arena_n(str, len, query, &arena);
+
+    arena_release(&arena);
+
+    return result;
+}
+
+/**
+ * Same as `flx_score_q` with scratch memory from ARENA.
+ * @param *str String to test.
+ * @param *query Compiled query use to score.
+ * @param *arena Scratch memory; reset by the call.
+ */
+flx_result* flx_score_arena(const char* str, const flx_query* query, flx_arena* arena) {
+    return flx_score_arena_n(str, strlen(str), query, arena);
+}
+
+/**
+ * Same as `flx_score_arena` with the LEN chars of STR.
+ * @param *str String to test; need not be NUL-terminated.
+ * @param len Length of STR.
+ * @param *query Compiled query use to score.
+ * @param *arena Scratch memory; reset by the call.
+ */
+flx_result* flx_score_arena_n(const char* str, size_t len, const flx_query* query,
+                              flx_arena* arena) {
+    flx_arena_reset(arena);
+
+    flx_result_buf buf = {0};
+    buf.indices        = arena_array(arena, int, query->len);
+    buf.capacity       = query->len;
+
+    if (!score_str(arena, NULL, str, (int)len, query, NONE, &buf)) {
+        return NULL;
+    }
+
+    return new_result(&buf);
+}
+
+/**
+ * Score QUERY against STR into the caller-provided OUT.
+ * @param *str String to test.
+ * @param *query Query use to score.
+ * @param *out Receive the score and up to OUT->capacity indices.
+ * @return Non-zero if there is a match.
+ */
+int flx_score_into(const char* str, const char* query, flx_result_buf* out) {
+    return flx_score_into_n(str, strlen(str), query, strlen(query), out);
+}
+
+/**
+ * Same as `flx_score_into` with the LEN chars of STR and the QLEN chars of
+ * QUERY.
+ * @param *str String to test; need not be NUL-terminated.
+ * @param len Length of STR.
+ * @param *query Query use to score; need not be NUL-terminated.
+ * @param qlen Length of QUERY.
+ * @param *out Receive the score and up to OUT->capacity indices.
+ * @return Non-zero if there is a match.
+ */
+int flx_score_into_n(const char* str, size_t len, const char* query, size_t qlen,
+                     flx_result_buf* out) {
+    flx_query q;
+    init_query(&q, query, qlen);
+    return flx_score_into_q_n(str, len, &q, out);
+}
+
+/**
+ * Same as `flx_score_into` with a compiled QUERY.
+ * @param *str String to test.
+ * @param *query Compiled query use to score.
+ * @param *out Receive the score and up to OUT->capacity indices.
+ * @return Non-zero if there is a match.
+ */
+int flx_score_into_q(const char* str, const flx_query* query, flx_result_buf* out) {
+    return flx_score_into_q_n(str, strlen(str), query, out);
+}
+
+/**
+ * Same as `flx_score_into_q` with the LEN chars of STR.
+ * @param *str String to test; need not be NUL-terminated.
+ * @param len Length of STR.
+ * @param *query Compiled query use to score.
+ * @param *out Receive the score and up to OUT->capacity indices.
+ * @return Non-zero if there is a match.
+ */
+int flx_score_into_q_n(const char* str, size_t len, const flx_query* query, flx_result_buf* out) {
+    STACK_ARENA(arena);
+
+    bool found = score_str(&arena, NULL, str, (int)len, query, NONE, out);
+
+    arena_release(&arena);
+
+    return found;
+}
+
+/**
+ * Same as `flx_score_into_q` with scratch memory from ARENA, for long
+ * strings whose scratch does not fit on the stack.
+ * @param *str String to test.
+ * @param *query Compiled query use to score.
+ * @param *arena Scratch memory; reset by the call.
+ * @param *out Receive the score and up to OUT->capacity indices.
+ * @return Non-zero if there is a match.
+ */
+int flx_score_into_arena(const char* str, const flx_query* query, flx_arena* arena,
+                         flx_result_buf* out) {
+    return flx_score_into_arena_n(str, strlen(str), query, arena, out);
+}
+
+/**
+ * Same as `flx_score_into_arena` with the LEN chars of STR.
+ * @param *str String to test; need not be NUL-terminated.
+ * @param len Length of STR.
+ * @param *query Compiled query use to score.
+ * @param *arena Scratch memory; reset by the call.
+ * @param *out Receive the score and up to OUT->capacity indices.
+ * @return Non-zero if there is a match.
+ */
+int flx_score_into_arena_n(const char* str, size_t len, const flx_query* query, flx_arena* arena,
+                           flx_result_buf* out) {
+    flx_arena_reset(arena);
+
+    return score_str(arena, NULL, str, (int)len, query, NONE, out);
+}
+
+/**
+ * Return best score matching compiled QUERY against prepared CANDIDATE.
+ * @param *candidate Prepared string to test.
+ * @param *query Compiled query use to score.
+ */
+flx_result* flx_score_candidate(const flx_candidate* candidate, const flx_query* query) {
+    STACK_ARENA(arena);
+
+    flx_result* result = flx_score_candidate_arena(candidate, query, &arena);
+
+    arena_release(&arena);
+
+    return result;
+}
+
+/**
+ * Same as `flx_score_candidate` with scratch memory from ARENA.
+ * @param *candidate Prepared string to test.
+ * @param *query Compiled query use to score.
+ * @param *arena Scratch memory; reset by the call.
+ */
+flx_result* flx_score_candidate_arena(const flx_candidate* candidate, const flx_query* query,
+                                      flx_arena* arena) {
+    flx_arena_reset(arena);
+
+    flx_result_buf buf = {0};
+    buf.indices        = arena_array(arena, int, query->len);
+    buf.capacity       = query->len;
+
+    if (!can_match(candidate, query) || !match_candidate(arena, candidate, query, NONE, &buf)) {
+        return NULL;
+    }
+
+    return new_result(&buf);
+}
+
+/**
+ * Compute an upper bound of the score of QUERY against STR.
+ * @param *str String to test.
+ * @param *query Query use to score.
+ * @param *bound Receive the bound.
+ * @return Non-zero if a match is possible at all.
+ */
+int flx_score_upper_bound(const char* str, const char* query, int* bound) {
+    return flx_score_upper_bound_n(str, strlen(str), query, strlen(query), bound);
+}
+
+/**
+ * Same as `flx_score_upper_bound` with the LEN chars of STR and the QLEN
+ * chars of QUERY.
+ * @param *str String to test; need not be NUL-terminated.
+ * @param len Length of STR.
+ * @param *query Query use to score; need not be NUL-terminated.
+ * @param qlen Length of QUERY.
+ * @param *bound Receive the bound.
+ * @return Non-zero if a match is possible at all.
+ */
+int flx_score_upper_bound_n(const char* str, size_t len, const char* query, size_t qlen,
+                            int* bound) {
+    flx_query q;
+    init_query(&q, query, qlen);
+
+    flx_candidate cand = {0};
+
+    cand.len = (int)len;
+
+    if (cand.len == 0 || q.len == 0 || !is_subsequence(str, cand.len, &q)) {
+        return false;
+    }
+
+    STACK_ARENA(arena);
+
+    get_hash_for_string(&arena, &cand, str);
+
+    cand.heatmap = get_heatmap_str(&arena, str, cand.len, NIL);
+
+    bool found = score_bound(&cand, &q, NULL, bound);
+
+    arena_release(&arena);
+
+    return found;
+}
+
+/**
+ * Compute an upper bound of the score of compiled QUERY against prepared
+ * CANDIDATE.
+ * @param *candidate Prepared string to test.
+ * @param *query Compiled query use to score.
+ * @param *bound Receive the bound.
+ * @return Non-zero if a match is possible at all.
+ */
+int flx_score_upper_bound_candidate(const flx_candidate* candidate, const flx_query* query,
+                                    int* bound) {
+    if (candidate->len == 0 || query->len == 0 || !can_match(candidate, query)) {
+        return false;
+    }
+
+    return score_bound(candidate, query, NULL, bound);
+}
 
-    flx_result result1 = optimal_match[0];
-
-    int caar = arrlen(result1.indices);
+/**
+ * Score every candidate against QUERY and sort the matches.
+ * @param **candidates Strings to test.
+ * @param n Number of candidates.
+ * @param *query Query use to score.
+ * @param *out Receive the matches; must hold N entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_score_many(const char** candidates, size_t n, const char* query, flx_match* out) {
+    flx_query q;
+    init_query(&q, query, strlen(query));
+    return flx_score_many_q(candidates, n, &q, out);
+}
 
-    if (full_match_boost && caar == str_len) {
-        result1.score += 10000;
+/**
+ * Score every candidate against compiled QUERY and sort the matches.
+ * @param **candidates Strings to test.
+ * @param n Number of candidates.
+ * @param *query Compiled query use to score.
+ * @param *out Receive the matches; must hold N entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_score_many_q(const char** candidates, size_t n, const flx_query* query,
+                        flx_match* out) {
+    size_t count = 0;
+
+    if (query->len == 0) {
+        return 0;
     }
 
-    /* Copy data */
-    {
-        result->indices = result1.indices;
-        result->score   = result1.score;
-        result->tail    = result1.tail;
+    STACK_ARENA(arena);
+
+    path_cache cache = {0};
+
+#if defined(BATCH_LANES)
+    score_batch batch;
+    batch_init(&batch, query);
+#endif
+
+    for (size_t i = 0; i < n; ++i) {
+        flx_result_buf result = {0};
+        size_t         len    = strlen(candidates[i]);
+
+#if defined(BATCH_LANES)
+        // Short strings are scored a batch at a time.
+        if (batch_take(&batch, query, i, candidates[i], (int)len)) {
+            if (batch.count == BATCH_LANES) {
+                batch_flush(&batch, query, out, &count, 0);
+            }
+            continue;
+        }
+#endif
+
+        flx_arena_reset(&arena);
+
+        if (!score_str(&arena, &cache, candidates[i], len, query, NONE, &result)) {
+            continue;
+        }
+
+        out[count].index = i;
+        out[count].score = result.score;
+        ++count;
     }
 
-    /* Free memories. */
-    free_internal(&optimal_match, &str_info, &heatmap, &match_cache);
+#if defined(BATCH_LANES)
+    batch_flush(&batch, query, out, &count, 0);
+#endif
+
+    path_cache_release(&cache);
+    arena_release(&arena);
 
-    return result;
+    qsort(out, count, sizeof(*out), compare_match);
+
+    return count;
+}
+
+/**
+ * Score every prepared candidate against compiled QUERY and sort the matches.
+ * @param **candidates Prepared strings to test.
+ * @param n Number of candidates.
+ * @param *query Compiled query use to score.
+ * @param *out Receive the matches; must hold N entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_score_candidates(const flx_candidate** candidates, size_t n, const flx_query* query,
+                            flx_match* out) {
+    size_t count = 0;
+
+    STACK_ARENA(arena);
+
+    for (size_t i = 0; i < n; ++i) {
+        flx_result_buf result = {0};
+
+        flx_arena_reset(&arena);
+
+        if (!can_match(candidates[i], query) ||
+            !match_candidate(&arena, candidates[i], query, NONE, &result)) {
+            continue;
+        }
+
+        out[count].index = i;
+        out[count].score = result.score;
+        ++count;
+    }
+
+    arena_release(&arena);
+
+    qsort(out, count, sizeof(*out), compare_match);
+
+    return count;
+}
+
+/**
+ * Score every candidate against QUERY and keep the best K matches.
+ *
+ * Matches are ordered as with `flx_score_many`.
+ * @param **candidates Strings to test.
+ * @param n Number of candidates.
+ * @param *query Query use to score.
+ * @param k Number of matches to keep.
+ * @param *out Receive the matches; must hold K entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_score_top(const char** candidates, size_t n, const char* query, size_t k,
+                     flx_match* out) {
+    flx_query q;
+    init_query(&q, query, strlen(query));
+    return flx_score_top_q(candidates, n, &q, k, out);
+}
+
+/**
+ * Score every candidate against compiled QUERY and keep the best K matches.
+ * @param **candidates Strings to test.
+ * @param n Number of candidates.
+ * @param *query Compiled query use to score.
+ * @param k Number of matches to keep.
+ * @param *out Receive the matches; must hold K entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_score_top_q(const char** candidates, size_t n, const flx_query* query, size_t k,
+                       flx_match* out) {
+    size_t count = 0;
+
+    if (query->len == 0 || k == 0) {
+        return 0;
+    }
+
+    STACK_ARENA(arena);
+
+    path_cache cache = {0};
+
+#if defined(BATCH_LANES)
+    score_batch batch;
+    batch_init(&batch, query);
+#endif
+
+    for (size_t i = 0; i < n; ++i) {
+        flx_result_buf result = {0};
+        size_t         len    = strlen(candidates[i]);
+
+#if defined(BATCH_LANES)
+        // Short strings are scored a batch at a time; whatever is in the heap
+        // came before them, so the threshold below still holds.
+        if (batch_take(&batch, query, i, candidates[i], (int)len)) {
+            if (batch.count == BATCH_LANES) {
+                batch_flush(&batch, query, out, &count, k);
+            }
+            continue;
+        }
+#endif
+
+        int threshold = heap_threshold(out, count, k);
+
+        flx_arena_reset(&arena);
+
+        if (!score_str(&arena, &cache, candidates[i], len, query, threshold, &result)) {
+            continue;
+        }
+
+        heap_offer(out, &count, k, (flx_match){i, result.score});
+    }
+
+#if defined(BATCH_LANES)
+    batch_flush(&batch, query, out, &count, k);
+#endif
+
+    path_cache_release(&cache);
+    arena_release(&arena);
+
+    qsort(out, count, sizeof(*out), compare_match);
+
+    return count;
+}
+
+/**
+ * Score every prepared candidate against compiled QUERY and keep the best K
+ * matches.
+ * @param **candidates Prepared strings to test.
+ * @param n Number of candidates.
+ * @param *query Compiled query use to score.
+ * @param k Number of matches to keep.
+ * @param *out Receive the matches; must hold K entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_score_top_candidates(const flx_candidate** candidates, size_t n,
+                                const flx_query* query, size_t k, flx_match* out) {
+    size_t count = 0;
+
+    if (k == 0) {
+        return 0;
+    }
+
+    STACK_ARENA(arena);
+
+    for (size_t i = 0; i < n; ++i) {
+        flx_result_buf result    = {0};
+        int            threshold = heap_threshold(out, count, k);
+
+        flx_arena_reset(&arena);
+
+        if (!can_match(candidates[i], query) ||
+            !match_candidate(&arena, candidates[i], query, threshold, &result)) {
+            continue;
+        }
+
+        heap_offer(out, &count, k, (flx_match){i, result.score});
+    }
+
+    arena_release(&arena);
+
+    qsort(out, count, sizeof(*out), compare_match);
+
+    return count;
+}
+
+/**
+ * Rank the candidates against compiled QUERY on THREADS threads and keep the
+ * best K matches.
+ * @param **candidates Strings to test.
+ * @param n Number of candidates.
+ * @param *query Compiled query use to score.
+ * @param k Number of matches to keep.
+ * @param threads Number of threads; 0 uses one per processor.
+ * @param *out Receive the matches; must hold K entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_score_top_parallel(const char** candidates, size_t n, const flx_query* query, size_t k,
+                              int threads, flx_match* out) {
+    if (query->len == 0 || k == 0) {
+        return 0;
+    }
+
+    flx_pool pool = {0};
+
+    pool.strs  = candidates;
+    pool.n     = n;
+    pool.query = query;
+    pool.k     = k;
+
+    return pool_run(&pool, threads, out);
+}
+
+/**
+ * Rank the prepared candidates against compiled QUERY on THREADS threads and
+ * keep the best K matches.
+ * @param **candidates Prepared strings to test.
+ * @param n Number of candidates.
+ * @param *query Compiled query use to score.
+ * @param k Number of matches to keep.
+ * @param threads Number of threads; 0 uses one per processor.
+ * @param *out Receive the matches; must hold K entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_score_top_candidates_parallel(const flx_candidate** candidates, size_t n,
+                                         const flx_query* query, size_t k, int threads,
+                                         flx_match* out) {
+    if (k == 0) {
+        return 0;
+    }
+
+    flx_pool pool = {0};
+
+    pool.cands = candidates;
+    pool.n     = n;
+    pool.query = query;
+    pool.k     = k;
+
+    return pool_run(&pool, threads, out);
+}
+
+/**
+ * Create a stream that ranks the lines it reads against compiled QUERY.
+ * @param *query Compiled query use to score; must outlive the stream.
+ * @param k Number of matches to keep.
+ * @return The stream; free it with `flx_stream_free`.
+ */
+flx_stream* flx_stream_new(const flx_query* query, size_t k) {
+    flx_stream* stream = calloc(1, sizeof(*stream));
+
+    stream->query = query;
+    stream->k     = k;
+    stream->heap  = malloc(sizeof(flx_match) * (k ? k : 1));
+    stream->cap   = STREAM_CHUNK_SIZE;
+    stream->buf   = malloc(stream->cap + 1);
+
+    return stream;
+}
+
+/**
+ * Read the next chunk of FD into STREAM and rank the lines it completes.
+ * @param *stream The stream.
+ * @param fd File descriptor to read.
+ * @return Bytes read; 0 at end of input, -1 on error.
+ */
+long flx_stream_read(flx_stream* stream, int fd) {
+    // Grow for lines longer than the buffer; keep a byte for the NUL.
+    if (stream->cap - stream->len < STREAM_CHUNK_SIZE / 2) {
+        stream->cap *= 2;
+        stream->buf = realloc(stream->buf, stream->cap + 1);
+    }
+
+#if defined(_WIN32)
+    long got = _read(fd, stream->buf + stream->len, (unsigned)(stream->cap - stream->len));
+#else
+    long got = read(fd, stream->buf + stream->len, stream->cap - stream->len);
+#endif
+
+    if (got < 0) {
+        return -1;
+    }
+
+    stream->len += got;
+    stream_drain(stream, got == 0);
+
+    return got;
+}
+
+/**
+ * Copy the current best matches of STREAM into OUT, sorted.
+ * @param *stream The stream.
+ * @param *out Receive the matches; must hold K entries.
+ * @param **strs Receive the text of each match unless NULL; valid until the
+ *               next read.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_stream_snapshot(const flx_stream* stream, flx_match* out, const char** strs) {
+    stream_text* texts = stream->texts;
+
+    memcpy(out, stream->heap, sizeof(flx_match) * stream->count);
+    qsort(out, stream->count, sizeof(*out), compare_match);
+
+    for (size_t i = 0; strs != NULL && i < stream->count; ++i) {
+        strs[i] = hmget(texts, out[i].index);
+    }
+
+    return stream->count;
+}
+
+/**
+ * Free stream.
+ * @param *stream The stream to free.
+ */
+void flx_stream_free(flx_stream* stream) {
+    for (ptrdiff_t i = 0; i < hmlen(stream->texts); ++i) {
+        free(stream->texts[i].value);
+    }
+
+    hmfree(stream->texts);
+    path_cache_release(&stream->cache);
+    free(stream->buf);
+    free(stream->heap);
+    free(stream);
+}
+
+/**
+ * Map the file at PATH and index its lines.
+ * @param *path File to open.
+ * @return The corpus, or NULL if the file cannot be mapped; free it with
+ *         `flx_corpus_free`.
+ */
+flx_corpus* flx_corpus_open(const char* path) {
+    flx_corpus* corpus = calloc(1, sizeof(*corpus));
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size)) {
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        free(corpus);
+        return NULL;
+    }
+
+    corpus->size = (size_t)size.QuadPart;
+
+    if (corpus->size > 0) {
+        // The view keeps the mapping alive once both handles are closed.
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        if (mapping != NULL) {
+            corpus->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+    }
+
+    CloseHandle(file);
+#else
+    int         fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(corpus);
+        return NULL;
+    }
+
+    corpus->size = (size_t)st.st_size;
+
+    if (corpus->size > 0) {
+        void* data = mmap(NULL, corpus->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        corpus->data = (data != MAP_FAILED) ? data : NULL;
+    }
+
+    close(fd);
+#endif
+
+    if (corpus->size > 0 && corpus->data == NULL) {
+        free(corpus);
+        return NULL;
+    }
+
+    corpus_index(corpus);
+
+    return corpus;
+}
+
+/**
+ * Return the number of lines in CORPUS.
+ * @param *corpus The corpus.
+ */
+size_t flx_corpus_count(const flx_corpus* corpus) { return corpus->count; }
+
+/**
+ * Return line INDEX of CORPUS, without its line terminator.
+ * @param *corpus The corpus.
+ * @param index Line number, from 0.
+ * @param *len Receive the length of the line.
+ * @return The line, in the mapped file; not NUL-terminated.
+ */
+const char* flx_corpus_line(const flx_corpus* corpus, size_t index, size_t* len) {
+    return corpus_line(corpus, index, len);
+}
+
+/**
+ * Score every line of CORPUS against compiled QUERY and keep the best K
+ * matches.
+ * @param *corpus Lines to test.
+ * @param *query Compiled query use to score.
+ * @param k Number of matches to keep.
+ * @param *out Receive the matches; must hold K entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_corpus_top(const flx_corpus* corpus, const flx_query* query, size_t k,
+                      flx_match* out) {
+    size_t count = 0;
+
+    if (query->len == 0 || k == 0) {
+        return 0;
+    }
+
+    STACK_ARENA(arena);
+
+    path_cache cache = {0};
+
+#if defined(BATCH_LANES)
+    score_batch batch;
+    batch_init(&batch, query);
+#endif
+
+    for (size_t i = 0; i < corpus->count; ++i) {
+        flx_result_buf result = {0};
+
+#if defined(BATCH_LANES)
+        size_t      len;
+        const char* line = corpus_line(corpus, i, &len);
+
+        // Short lines are scored a batch at a time, as in `flx_score_top_q`.
+        if (batch_take(&batch, query, i, line, (int)len)) {
+            if (batch.count == BATCH_LANES) {
+                batch_flush(&batch, query, out, &count, k);
+            }
+            continue;
+        }
+#endif
+
+        int threshold = heap_threshold(out, count, k);
+
+        flx_arena_reset(&arena);
+
+        if (!corpus_score(&arena, &cache, corpus, i, query, threshold, &result)) {
+            continue;
+        }
+
+        heap_offer(out, &count, k, (flx_match){i, result.score});
+    }
+
+#if defined(BATCH_LANES)
+    batch_flush(&batch, query, out, &count, k);
+#endif
+
+    path_cache_release(&cache);
+    arena_release(&arena);
+
+    qsort(out, count, sizeof(*out), compare_match);
+
+    return count;
+}
+
+/**
+ * Rank the lines of CORPUS against compiled QUERY on THREADS threads and keep
+ * the best K matches.
+ * @param *corpus Lines to test.
+ * @param *query Compiled query use to score.
+ * @param k Number of matches to keep.
+ * @param threads Number of threads; 0 uses one per processor.
+ * @param *out Receive the matches; must hold K entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_corpus_top_parallel(const flx_corpus* corpus, const flx_query* query, size_t k,
+                               int threads, flx_match* out) {
+    if (query->len == 0 || k == 0) {
+        return 0;
+    }
+
+    flx_pool pool = {0};
+
+    pool.corpus = corpus;
+    pool.n      = corpus->count;
+    pool.query  = query;
+    pool.k      = k;
+
+    return pool_run(&pool, threads, out);
+}
+
+/**
+ * Free corpus and unmap its file.
+ * @param *corpus The corpus to free.
+ */
+void flx_corpus_free(flx_corpus* corpus) {
+    if (corpus->data != NULL) {
+#if defined(_WIN32)
+        UnmapViewOfFile(corpus->data);
+#else
+        munmap((void*)corpus->data, corpus->size);
+#endif
+    }
+
+    arrfree(corpus->starts);
+    free(corpus);
+}
+
+/**
+ * Index PATHS by their shared directories.
+ * @param **paths Paths to index; must outlive the trie.
+ * @param n Number of paths.
+ * @return The trie; free it with `flx_trie_free`.
+ */
+flx_trie* flx_trie_new(const char** paths, size_t n) {
+    flx_trie* trie = calloc(1, sizeof(*trie));
+
+    arrsetlen(trie->entries, n);
+
+    for (size_t i = 0; i < n; ++i) {
+        trie->entries[i] = (trie_entry){paths[i], (int)strlen(paths[i]), i};
+    }
+
+    return trie_finish(trie);
+}
+
+/**
+ * Index the lines of CORPUS by their shared directories.
+ * @param *corpus Paths to index, one per line; must outlive the trie.
+ * @return The trie; free it with `flx_trie_free`.
+ */
+flx_trie* flx_trie_new_corpus(const flx_corpus* corpus) {
+    flx_trie* trie = calloc(1, sizeof(*trie));
+
+    arrsetlen(trie->entries, corpus->count);
+
+    for (size_t i = 0; i < corpus->count; ++i) {
+        size_t      len;
+        const char* line = corpus_line(corpus, i, &len);
+
+        trie->entries[i] = (trie_entry){line, (int)len, i};
+    }
+
+    return trie_finish(trie);
+}
+
+/**
+ * Score the paths of TRIE against compiled QUERY and keep the best K matches.
+ * @param *trie Paths to test.
+ * @param *query Compiled query use to score.
+ * @param k Number of matches to keep.
+ * @param *out Receive the matches; must hold K entries.
+ * @return Number of matches written to OUT.
+ */
+size_t flx_trie_top(const flx_trie* trie, const flx_query* query, size_t k, flx_match* out) {
+    if (query->len == 0 || k == 0 || arrlen(trie->nodes) == 0) {
+        return 0;
+    }
+
+    uint64_t* rest = malloc(sizeof(uint64_t) * (query->len + 1));
+
+    rest[query->len] = 0;
+
+    for (int i = query->len - 1; i >= 0; --i) {
+        rest[i] = rest[i + 1] | char_bit(query->str[i]);
+    }
+
+    STACK_ARENA(arena);
+
+    path_cache cache = {0};
+
+    trie_search search = {trie, query, rest, &arena, &cache, out, 0, k};
+
+    trie_visit(&search, 0, 0);
+
+    path_cache_release(&cache);
+    arena_release(&arena);
+    free(rest);
+
+    qsort(out, search.count, sizeof(*out), compare_match);
+
+    return search.count;
+}
+
+/**
+ * Free trie.
+ * @param *trie The trie to free.
+ */
+void flx_trie_free(flx_trie* trie) {
+    arrfree(trie->entries);
+    arrfree(trie->nodes);
+    free(trie);
 }
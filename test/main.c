@@ -7,7 +7,10 @@
  *                   Copyright © 2024 by Shen, Jen-Chieh $
  */
 
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "../include/stb_ds.h"
 
@@ -53,8 +56,94 @@ flx_result* get_result() {
     return &result;
 }
 
+#if defined(__GLIBC__)
+// Count the calls to malloc by standing in for glibc's allocator.
+static size_t malloc_calls = 0;
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void  __libc_free(void* ptr);
+
+void* malloc(size_t size) {
+    ++malloc_calls;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) { return __libc_calloc(count, size); }
+void* realloc(void* ptr, size_t size) { return __libc_realloc(ptr, size); }
+void  free(void* ptr) { __libc_free(ptr); }
+
+/**
+ * Return the malloc calls of ranking N long strings; a warm arena makes none
+ * past the first string.
+ */
+size_t rank_long_strings(size_t n) {
+    static char  str[1000];
+    const char*  strs[64];
+    flx_match    match;
+
+    memset(str, 'a', sizeof(str) - 1);
+
+    for (size_t i = 0; i < n; ++i) {
+        strs[i] = str;
+    }
+
+    size_t before = malloc_calls;
+    flx_score_top(strs, n, "aa", 1, &match);
+    return malloc_calls - before;
+}
+
+/**
+ * Return the malloc calls of scoring a long string with indices into a warm
+ * arena; there are none.
+ */
+size_t score_long_string_into(void) {
+    static char    str[1000];
+    int            indices[8];
+    flx_result_buf buf   = {0};
+    flx_query*     query = flx_query_compile("aaaaaaaa");
+    flx_arena*     arena = flx_arena_new(0);
+
+    memset(str, 'a', sizeof(str) - 1);
+    buf.indices  = indices;
+    buf.capacity = 8;
+
+    // The first call spills over several blocks, which the next one merges.
+    flx_score_into_arena(str, query, arena, &buf);
+    flx_score_into_arena(str, query, arena, &buf);
+
+    size_t before = malloc_calls;
+    flx_score_into_arena(str, query, arena, &buf);
+    size_t calls = malloc_calls - before;
+
+    flx_arena_free(arena);
+    flx_query_free(query);
+
+    return calls;
+}
+#endif
+
+/**
+ * Return true if the N matches of A equal the M matches of B, index and
+ * score; print NAME otherwise.
+ */
+bool same_matches(const char* name, const flx_match* a, size_t n, const flx_match* b, size_t m) {
+    bool same = (n == m);
+
+    for (size_t i = 0; same && i < n; ++i) {
+        same = (a[i].index == b[i].index && a[i].score == b[i].score);
+    }
+
+    if (!same)
+        fprintf(stderr, "%s: matches differ\n", name);
+
+    return same;
+}
+
 int main(int argc, char* argv[]) {
-    flx_result* result = flx_score("buffer-file-name", "bfn");
+    int         failures = 0;
+    flx_result* result   = flx_score("buffer-file-name", "bfn");
 
     if (result == NULL)
         return -1;
@@ -67,5 +156,223 @@ int main(int argc, char* argv[]) {
 
     flx_free(result);
 
-    return 0;
+    // Score a slice of a larger buffer; neither string is NUL-terminated.
+    const char* text = "[buffer-file-name]";
+
+    result = flx_score_n(text + 1, 16, "bfnx", 3);
+    printf("Score (slice): %d\n", result ? result->score : 0);
+
+    flx_free(result);
+
+    int            indices[8];
+    flx_result_buf buf = {0};
+    buf.indices        = indices;
+    buf.capacity       = 8;
+
+    if (flx_score_into("buffer-file-name", "bfn", &buf)) {
+        printf("Score (into): %d, %d indices\n", buf.score, buf.len);
+    }
+
+    const char* candidates[] = {"find-file", "buffer-file-name", "switch-to-buffer", "bfn"};
+    flx_match   matches[4];
+
+    size_t count = flx_score_many(candidates, 4, "bfn", matches);
+
+    for (size_t i = 0; i < count; ++i) {
+        printf("(%zu) %s: %d\n", i, candidates[matches[i].index], matches[i].score);
+    }
+
+    count = flx_score_top(candidates, 4, "bfn", 2, matches);
+
+    for (size_t i = 0; i < count; ++i) {
+        printf("top (%zu) %s: %d\n", i, candidates[matches[i].index], matches[i].score);
+    }
+
+    FILE* lines = tmpfile();
+
+    if (lines != NULL) {
+        fputs("find-file\nbuffer-file-name\nswitch-to-buffer\nbfn", lines);
+        rewind(lines);
+
+        flx_query*  bfn    = flx_query_compile("bfn");
+        flx_stream* stream = flx_stream_new(bfn, 2);
+        const char* strs[2];
+
+        while (flx_stream_read(stream, fileno(lines)) > 0) {}
+
+        count = flx_stream_snapshot(stream, matches, strs);
+
+        for (size_t i = 0; i < count; ++i) {
+            printf("stream (%zu) %s: %d\n", i, strs[i], matches[i].score);
+        }
+
+        flx_stream_free(stream);
+        flx_query_free(bfn);
+        fclose(lines);
+    }
+
+    // Siblings share the heatmap of their directory; basenames of 35 and 37
+    // words zero the basepath boost alone and within the path.
+    flx_query* path_query = flx_query_compile_path("w");
+
+    for (int words = 35; words <= 37; words += 2) {
+        char        basename[128] = "a/b/c/x";
+        const char* paths[2]      = {"a/b/c/w", basename};
+
+        for (int i = 1; i < words; ++i) {
+            strcat(basename, "-w");
+        }
+
+        count = flx_score_many_q(paths, 2, path_query, matches);
+
+        for (size_t i = 0; i < count; ++i) {
+            flx_result* alone = flx_score_q(paths[matches[i].index], path_query);
+            printf("path (%d words) %zu: %d, alone: %d\n", words, matches[i].index,
+                   matches[i].score, alone ? alone->score : 0);
+            flx_free(alone);
+        }
+    }
+
+    flx_query_free(path_query);
+
+    // The trie matches each directory once, and skips docs/zzz outright.
+    const char* tree[] = {
+        "src/core/buffer.c",   "src/core/file_name.c", "src/core/io/bfn.c",
+        "src/ui/buffer_view.c", "docs/zzz/readme.md",   "test/buffer-file-name.c",
+    };
+    flx_query* tree_query = flx_query_compile_path("bfn");
+    flx_trie*  trie       = flx_trie_new(tree, 6);
+    flx_match  flat[3];
+
+    count        = flx_trie_top(trie, tree_query, 3, matches);
+    size_t found = flx_score_top_q(tree, 6, tree_query, 3, flat);
+
+    for (size_t i = 0; i < count || i < found; ++i) {
+        printf("trie (%zu) %s: %d, flat: %s: %d\n", i,
+               (i < count) ? tree[matches[i].index] : "-", (i < count) ? matches[i].score : 0,
+               (i < found) ? tree[flat[i].index] : "-", (i < found) ? flat[i].score : 0);
+    }
+
+    failures += !same_matches("trie", flat, found, matches, count);
+
+    flx_trie_free(trie);
+    flx_query_free(tree_query);
+
+    // Enough candidates for several chunks, so threads steal and merge.
+    enum { MANY = 5000, TOP = 5 };
+
+    static char           names[MANY][32];
+    static const char*    many[MANY];
+    static flx_candidate* prepared[MANY];
+    flx_query*            many_query = flx_query_compile("bf1");
+    flx_match             serial[TOP], parallel[TOP], parallel_prepared[TOP];
+
+    for (int i = 0; i < MANY; ++i) {
+        snprintf(names[i], sizeof(names[i]), "%s-%d/file-%d.c", (i % 7) ? "lib" : "buffer", i,
+                 i * 37 % 1000);
+        many[i]     = names[i];
+        prepared[i] = flx_candidate_new(names[i]);
+    }
+
+    count        = flx_score_top_q(many, MANY, many_query, TOP, serial);
+    size_t split = flx_score_top_parallel(many, MANY, many_query, TOP, 4, parallel);
+    size_t ready = flx_score_top_candidates_parallel((const flx_candidate**)prepared, MANY,
+                                                     many_query, TOP, 4, parallel_prepared);
+
+    for (size_t i = 0; i < count; ++i) {
+        printf("parallel (%zu) %s: %d, %s: %d, %s: %d\n", i, many[serial[i].index],
+               serial[i].score, (i < split) ? many[parallel[i].index] : "-",
+               (i < split) ? parallel[i].score : 0,
+               (i < ready) ? many[parallel_prepared[i].index] : "-",
+               (i < ready) ? parallel_prepared[i].score : 0);
+    }
+
+    failures += !same_matches("parallel", serial, count, parallel, split);
+    failures += !same_matches("parallel prepared", serial, count, parallel_prepared, ready);
+
+    for (int i = 0; i < MANY; ++i) {
+        flx_candidate_free(prepared[i]);
+    }
+
+    flx_query_free(many_query);
+
+    // A corpus with a CRLF line and no newline after the last line.
+    const char* corpus_path = "flx_corpus_demo.txt";
+    FILE*       corpus_file = fopen(corpus_path, "wb");
+
+    if (corpus_file != NULL) {
+        fputs("find-file\r\nbuffer-file-name\nswitch-to-buffer\nbfn", corpus_file);
+        fclose(corpus_file);
+
+        flx_corpus* corpus       = flx_corpus_open(corpus_path);
+        flx_query*  corpus_query = flx_query_compile("bfn");
+
+        if (corpus != NULL) {
+            for (size_t i = 0; i < flx_corpus_count(corpus); ++i) {
+                size_t      len;
+                const char* line = flx_corpus_line(corpus, i, &len);
+                printf("line (%zu) [%.*s]\n", i, (int)len, line);
+            }
+
+            flx_trie* corpus_trie = flx_trie_new_corpus(corpus);
+            flx_match threaded[4], indexed[4];
+
+            count             = flx_corpus_top(corpus, corpus_query, 4, matches);
+            size_t split      = flx_corpus_top_parallel(corpus, corpus_query, 4, 2, threaded);
+            size_t trie_found = flx_trie_top(corpus_trie, corpus_query, 4, indexed);
+
+            for (size_t i = 0; i < count; ++i) {
+                printf("corpus (%zu) line %zu: %d, parallel: line %zu: %d, trie: line %zu: %d\n",
+                       i, matches[i].index, matches[i].score,
+                       (i < split) ? threaded[i].index : 0, (i < split) ? threaded[i].score : 0,
+                       (i < trie_found) ? indexed[i].index : 0,
+                       (i < trie_found) ? indexed[i].score : 0);
+            }
+
+            failures += !same_matches("corpus parallel", matches, count, threaded, split);
+            failures += !same_matches("corpus trie", matches, count, indexed, trie_found);
+
+            flx_trie_free(corpus_trie);
+            flx_corpus_free(corpus);
+        } else {
+            fprintf(stderr, "corpus: cannot map %s\n", corpus_path);
+            ++failures;
+        }
+
+        flx_query_free(corpus_query);
+        remove(corpus_path);
+    }
+
+#if defined(__GLIBC__)
+    printf("mallocs (2 long strings): %zu, (64 long strings): %zu\n", rank_long_strings(2),
+           rank_long_strings(64));
+    printf("mallocs (warm arena, with indices): %zu\n", score_long_string_into());
+#endif
+
+    flx_query* query = flx_query_compile("stb");
+
+    for (size_t i = 0; i < 4; ++i) {
+        flx_result* res = flx_score_q(candidates[i], query);
+        printf("%s: %d\n", candidates[i], res ? res->score : 0);
+        flx_free(res);
+    }
+
+    flx_candidate* candidate = flx_candidate_new("switch-to-buffer");
+    flx_result*    res       = flx_score_candidate(candidate, query);
+
+    printf("prepared: %d\n", res ? res->score : 0);
+
+    flx_free(res);
+
+    flx_arena* arena = flx_arena_new(0);
+
+    res = flx_score_candidate_arena(candidate, query, arena);
+    printf("arena: %d\n", res ? res->score : 0);
+
+    flx_free(res);
+    flx_arena_free(arena);
+    flx_candidate_free(candidate);
+    flx_query_free(query);
+
+    return failures ? 1 : 0;
 }